@@ -11,6 +11,82 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// boldStreamARCpp
+Rcpp::List boldStreamARCpp(std::string BOLD_file, int nV, SEXP design, const Rcpp::LogicalVector valid_cols, int ar_order, bool aic, int chunk_size, int n_threads);
+RcppExport SEXP _BayesfMRI_boldStreamARCpp(SEXP BOLD_fileSEXP, SEXP nVSEXP, SEXP designSEXP, SEXP valid_colsSEXP, SEXP ar_orderSEXP, SEXP aicSEXP, SEXP chunk_sizeSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< std::string >::type BOLD_file(BOLD_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type nV(nVSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type design(designSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector >::type valid_cols(valid_colsSEXP);
+    Rcpp::traits::input_parameter< int >::type ar_order(ar_orderSEXP);
+    Rcpp::traits::input_parameter< bool >::type aic(aicSEXP);
+    Rcpp::traits::input_parameter< int >::type chunk_size(chunk_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(boldStreamARCpp(BOLD_file, nV, design, valid_cols, ar_order, aic, chunk_size, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// boldStreamCrossprodCpp
+Rcpp::List boldStreamCrossprodCpp(std::string BOLD_file, SEXP design, const Eigen::Map<Eigen::SparseMatrix<double> > A_sparse, const Eigen::Map<Eigen::MatrixXd> AR_coefs, const Eigen::Map<Eigen::VectorXd> avg_var, const Rcpp::LogicalVector valid_cols, int chunk_size, int n_threads, bool mixed_precision);
+RcppExport SEXP _BayesfMRI_boldStreamCrossprodCpp(SEXP BOLD_fileSEXP, SEXP designSEXP, SEXP A_sparseSEXP, SEXP AR_coefsSEXP, SEXP avg_varSEXP, SEXP valid_colsSEXP, SEXP chunk_sizeSEXP, SEXP n_threadsSEXP, SEXP mixed_precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< std::string >::type BOLD_file(BOLD_fileSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type design(designSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::SparseMatrix<double> > >::type A_sparse(A_sparseSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type AR_coefs(AR_coefsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::VectorXd> >::type avg_var(avg_varSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector >::type valid_cols(valid_colsSEXP);
+    Rcpp::traits::input_parameter< int >::type chunk_size(chunk_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type mixed_precision(mixed_precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(boldStreamCrossprodCpp(BOLD_file, design, A_sparse, AR_coefs, avg_var, valid_cols, chunk_size, n_threads, mixed_precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// connectedComponentsCpp
+Rcpp::List connectedComponentsCpp(const Rcpp::IntegerMatrix tv, const Rcpp::IntegerVector active, const Rcpp::NumericVector area);
+RcppExport SEXP _BayesfMRI_connectedComponentsCpp(SEXP tvSEXP, SEXP activeSEXP, SEXP areaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix >::type tv(tvSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector >::type active(activeSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector >::type area(areaSEXP);
+    rcpp_result_gen = Rcpp::wrap(connectedComponentsCpp(tv, active, area));
+    return rcpp_result_gen;
+END_RCPP
+}
+// emStatsUpdateCpp
+Rcpp::List emStatsUpdateCpp(Rcpp::Nullable<Rcpp::List> stats, const Eigen::Map<Eigen::MatrixXd> BOLD, const Rcpp::NumericVector design, const Eigen::Map<Eigen::MatrixXd> AR_coefs, const Eigen::Map<Eigen::VectorXd> avg_var, int n_threads);
+RcppExport SEXP _BayesfMRI_emStatsUpdateCpp(SEXP statsSEXP, SEXP BOLDSEXP, SEXP designSEXP, SEXP AR_coefsSEXP, SEXP avg_varSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::List> >::type stats(statsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type BOLD(BOLDSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector >::type design(designSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type AR_coefs(AR_coefsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::VectorXd> >::type avg_var(avg_varSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(emStatsUpdateCpp(stats, BOLD, design, AR_coefs, avg_var, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// emStatsCrossprodCpp
+Rcpp::List emStatsCrossprodCpp(const Rcpp::List stats, const Eigen::Map<Eigen::SparseMatrix<double> > A_sparse, const Eigen::Map<Eigen::MatrixXd> AR_coefs, const Eigen::Map<Eigen::VectorXd> avg_var, const Rcpp::LogicalVector valid_cols);
+RcppExport SEXP _BayesfMRI_emStatsCrossprodCpp(SEXP statsSEXP, SEXP A_sparseSEXP, SEXP AR_coefsSEXP, SEXP avg_varSEXP, SEXP valid_colsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type stats(statsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::SparseMatrix<double> > >::type A_sparse(A_sparseSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type AR_coefs(AR_coefsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::VectorXd> >::type avg_var(avg_varSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector >::type valid_cols(valid_colsSEXP);
+    rcpp_result_gen = Rcpp::wrap(emStatsCrossprodCpp(stats, A_sparse, AR_coefs, avg_var, valid_cols));
+    return rcpp_result_gen;
+END_RCPP
+}
 // logDetQt
 double logDetQt(double kappa2, const Rcpp::List& in_list, double n_sess);
 RcppExport SEXP _BayesfMRI_logDetQt(SEXP kappa2SEXP, SEXP in_listSEXP, SEXP n_sessSEXP) {
@@ -39,10 +115,11 @@ BEGIN_RCPP
 END_RCPP
 }
 // findTheta
-Rcpp::List findTheta(Eigen::VectorXd theta, List spde, Eigen::VectorXd y, Eigen::SparseMatrix<double> X, Eigen::SparseMatrix<double> QK, Eigen::SparseMatrix<double> Psi, Eigen::SparseMatrix<double> A, int Ns, double tol, bool verbose);
-RcppExport SEXP _BayesfMRI_findTheta(SEXP thetaSEXP, SEXP spdeSEXP, SEXP ySEXP, SEXP XSEXP, SEXP QKSEXP, SEXP PsiSEXP, SEXP ASEXP, SEXP NsSEXP, SEXP tolSEXP, SEXP verboseSEXP) {
+Rcpp::List findTheta(Eigen::VectorXd theta, List spde, Eigen::VectorXd y, Eigen::SparseMatrix<double> X, Eigen::SparseMatrix<double> QK, Eigen::SparseMatrix<double> Psi, Eigen::SparseMatrix<double> A, int Ns, double tol, bool verbose, bool mixed_precision, std::string checkpoint_file, int checkpoint_every, std::string resume, Rcpp::Nullable<Rcpp::List> warm_start, bool return_var, int n_samples);
+RcppExport SEXP _BayesfMRI_findTheta(SEXP thetaSEXP, SEXP spdeSEXP, SEXP ySEXP, SEXP XSEXP, SEXP QKSEXP, SEXP PsiSEXP, SEXP ASEXP, SEXP NsSEXP, SEXP tolSEXP, SEXP verboseSEXP, SEXP mixed_precisionSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP, SEXP resumeSEXP, SEXP warm_startSEXP, SEXP return_varSEXP, SEXP n_samplesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Eigen::VectorXd >::type theta(thetaSEXP);
     Rcpp::traits::input_parameter< List >::type spde(spdeSEXP);
     Rcpp::traits::input_parameter< Eigen::VectorXd >::type y(ySEXP);
@@ -53,7 +130,134 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type Ns(NsSEXP);
     Rcpp::traits::input_parameter< double >::type tol(tolSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(findTheta(theta, spde, y, X, QK, Psi, A, Ns, tol, verbose));
+    Rcpp::traits::input_parameter< bool >::type mixed_precision(mixed_precisionSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< std::string >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::List> >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< bool >::type return_var(return_varSEXP);
+    Rcpp::traits::input_parameter< int >::type n_samples(n_samplesSEXP);
+    rcpp_result_gen = Rcpp::wrap(findTheta(theta, spde, y, X, QK, Psi, A, Ns, tol, verbose, mixed_precision, checkpoint_file, checkpoint_every, resume, warm_start, return_var, n_samples));
+    return rcpp_result_gen;
+END_RCPP
+}
+// findThetaStatsCpp
+Rcpp::List findThetaStatsCpp(Eigen::VectorXd theta, List spde, Eigen::VectorXd XpsiY, Eigen::SparseMatrix<double> A, double yy, double n_obs, Eigen::SparseMatrix<double> QK, int Ns, double tol, int max_evals, Rcpp::Nullable<Rcpp::List> warm_start, bool verbose, bool mixed_precision);
+RcppExport SEXP _BayesfMRI_findThetaStatsCpp(SEXP thetaSEXP, SEXP spdeSEXP, SEXP XpsiYSEXP, SEXP ASEXP, SEXP yySEXP, SEXP n_obsSEXP, SEXP QKSEXP, SEXP NsSEXP, SEXP tolSEXP, SEXP max_evalsSEXP, SEXP warm_startSEXP, SEXP verboseSEXP, SEXP mixed_precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Eigen::VectorXd >::type theta(thetaSEXP);
+    Rcpp::traits::input_parameter< List >::type spde(spdeSEXP);
+    Rcpp::traits::input_parameter< Eigen::VectorXd >::type XpsiY(XpsiYSEXP);
+    Rcpp::traits::input_parameter< Eigen::SparseMatrix<double> >::type A(ASEXP);
+    Rcpp::traits::input_parameter< double >::type yy(yySEXP);
+    Rcpp::traits::input_parameter< double >::type n_obs(n_obsSEXP);
+    Rcpp::traits::input_parameter< Eigen::SparseMatrix<double> >::type QK(QKSEXP);
+    Rcpp::traits::input_parameter< int >::type Ns(NsSEXP);
+    Rcpp::traits::input_parameter< double >::type tol(tolSEXP);
+    Rcpp::traits::input_parameter< int >::type max_evals(max_evalsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::List> >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< bool >::type mixed_precision(mixed_precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(findThetaStatsCpp(theta, spde, XpsiY, A, yy, n_obs, QK, Ns, tol, max_evals, warm_start, verbose, mixed_precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// readEMCheckpointCpp
+Rcpp::List readEMCheckpointCpp(std::string path);
+RcppExport SEXP _BayesfMRI_readEMCheckpointCpp(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(readEMCheckpointCpp(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// crossprodSubjectsCpp
+Rcpp::List crossprodSubjectsCpp(const Rcpp::List Xcros, const Rcpp::List Xycros, const Rcpp::LogicalVector drop, int n_threads);
+RcppExport SEXP _BayesfMRI_crossprodSubjectsCpp(SEXP XcrosSEXP, SEXP XycrosSEXP, SEXP dropSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type Xcros(XcrosSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type Xycros(XycrosSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector >::type drop(dropSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(crossprodSubjectsCpp(Xcros, Xycros, drop, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// convolveHRFCpp
+Eigen::MatrixXd convolveHRFCpp(const Eigen::Map<Eigen::MatrixXd> stim, const Eigen::Map<Eigen::MatrixXd> HRF, const Rcpp::IntegerMatrix pairs, const Rcpp::IntegerVector inds, Rcpp::Nullable<Rcpp::NumericMatrix> stim_one, int n_threads);
+RcppExport SEXP _BayesfMRI_convolveHRFCpp(SEXP stimSEXP, SEXP HRFSEXP, SEXP pairsSEXP, SEXP indsSEXP, SEXP stim_oneSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type stim(stimSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type HRF(HRFSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix >::type pairs(pairsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector >::type inds(indsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericMatrix> >::type stim_one(stim_oneSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(convolveHRFCpp(stim, HRF, pairs, inds, stim_one, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// meshAdjacencyCpp
+Eigen::SparseMatrix<double> meshAdjacencyCpp(const Rcpp::IntegerMatrix faces, int n_vertex);
+RcppExport SEXP _BayesfMRI_meshAdjacencyCpp(SEXP facesSEXP, SEXP n_vertexSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix >::type faces(facesSEXP);
+    Rcpp::traits::input_parameter< int >::type n_vertex(n_vertexSEXP);
+    rcpp_result_gen = Rcpp::wrap(meshAdjacencyCpp(faces, n_vertex));
+    return rcpp_result_gen;
+END_RCPP
+}
+// boundaryLayersCpp
+Rcpp::NumericVector boundaryLayersCpp(const Eigen::Map<Eigen::SparseMatrix<double> > adj, const Rcpp::LogicalVector mask, int boundary_width);
+RcppExport SEXP _BayesfMRI_boundaryLayersCpp(SEXP adjSEXP, SEXP maskSEXP, SEXP boundary_widthSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::SparseMatrix<double> > >::type adj(adjSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< int >::type boundary_width(boundary_widthSEXP);
+    rcpp_result_gen = Rcpp::wrap(boundaryLayersCpp(adj, mask, boundary_width));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcmOrderCpp
+Rcpp::IntegerVector rcmOrderCpp(const Eigen::Map<Eigen::SparseMatrix<double> > adj);
+RcppExport SEXP _BayesfMRI_rcmOrderCpp(SEXP adjSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::SparseMatrix<double> > >::type adj(adjSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcmOrderCpp(adj));
+    return rcpp_result_gen;
+END_RCPP
+}
+// multiGLMCpp
+Rcpp::List multiGLMCpp(const Eigen::Map<Eigen::MatrixXd> y, const Rcpp::NumericVector X, const Eigen::Map<Eigen::MatrixXd> N, const Eigen::Map<Eigen::MatrixXd> Xc, int n_threads);
+RcppExport SEXP _BayesfMRI_multiGLMCpp(SEXP ySEXP, SEXP XSEXP, SEXP NSEXP, SEXP XcSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type y(ySEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector >::type X(XSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type N(NSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type Xc(XcSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(multiGLMCpp(y, X, N, Xc, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nuisanceRegressionCpp
+Eigen::MatrixXd nuisanceRegressionCpp(const Eigen::Map<Eigen::MatrixXd> BOLD, const Rcpp::NumericVector design, int n_threads);
+RcppExport SEXP _BayesfMRI_nuisanceRegressionCpp(SEXP BOLDSEXP, SEXP designSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type BOLD(BOLDSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector >::type design(designSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(nuisanceRegressionCpp(BOLD, design, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -70,12 +274,93 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// getSqrtInvAllCpp
+Eigen::SparseMatrix<double> getSqrtInvAllCpp(const Eigen::Map<Eigen::MatrixXd> AR_coefs, int nTime, const Eigen::Map<Eigen::VectorXd> avg_var, int n_threads, bool mixed_precision);
+RcppExport SEXP _BayesfMRI_getSqrtInvAllCpp(SEXP AR_coefsSEXP, SEXP nTimeSEXP, SEXP avg_varSEXP, SEXP n_threadsSEXP, SEXP mixed_precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type AR_coefs(AR_coefsSEXP);
+    Rcpp::traits::input_parameter< int >::type nTime(nTimeSEXP);
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::VectorXd> >::type avg_var(avg_varSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type mixed_precision(mixed_precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(getSqrtInvAllCpp(AR_coefs, nTime, avg_var, n_threads, mixed_precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// surfLumpedMassCpp
+Eigen::VectorXd surfLumpedMassCpp(const Eigen::Map<Eigen::MatrixXd> vertices, const Rcpp::IntegerMatrix faces, int n_threads);
+RcppExport SEXP _BayesfMRI_surfLumpedMassCpp(SEXP verticesSEXP, SEXP facesSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type vertices(verticesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix >::type faces(facesSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(surfLumpedMassCpp(vertices, faces, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// surfFEMCpp
+Rcpp::List surfFEMCpp(const Eigen::Map<Eigen::MatrixXd> vertices, const Rcpp::IntegerMatrix faces, int n_threads);
+RcppExport SEXP _BayesfMRI_surfFEMCpp(SEXP verticesSEXP, SEXP facesSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< const Eigen::Map<Eigen::MatrixXd> >::type vertices(verticesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix >::type faces(facesSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(surfFEMCpp(vertices, faces, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// traceProbeCpp
+Rcpp::List traceProbeCpp(int n_threads);
+RcppExport SEXP _BayesfMRI_traceProbeCpp(SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(traceProbeCpp(n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// vol2spdeCpp
+Rcpp::List vol2spdeCpp(Eigen::VectorXd x, Eigen::VectorXd y, Eigen::VectorXd z, Rcpp::IntegerVector idx, int radius);
+RcppExport SEXP _BayesfMRI_vol2spdeCpp(SEXP xSEXP, SEXP ySEXP, SEXP zSEXP, SEXP idxSEXP, SEXP radiusSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Eigen::VectorXd >::type x(xSEXP);
+    Rcpp::traits::input_parameter< Eigen::VectorXd >::type y(ySEXP);
+    Rcpp::traits::input_parameter< Eigen::VectorXd >::type z(zSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< int >::type radius(radiusSEXP);
+    rcpp_result_gen = Rcpp::wrap(vol2spdeCpp(x, y, z, idx, radius));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_BayesfMRI_boldStreamARCpp", (DL_FUNC) &_BayesfMRI_boldStreamARCpp, 8},
+    {"_BayesfMRI_boldStreamCrossprodCpp", (DL_FUNC) &_BayesfMRI_boldStreamCrossprodCpp, 9},
+    {"_BayesfMRI_connectedComponentsCpp", (DL_FUNC) &_BayesfMRI_connectedComponentsCpp, 3},
+    {"_BayesfMRI_emStatsUpdateCpp", (DL_FUNC) &_BayesfMRI_emStatsUpdateCpp, 6},
+    {"_BayesfMRI_emStatsCrossprodCpp", (DL_FUNC) &_BayesfMRI_emStatsCrossprodCpp, 5},
     {"_BayesfMRI_logDetQt", (DL_FUNC) &_BayesfMRI_logDetQt, 3},
     {"_BayesfMRI_initialKP", (DL_FUNC) &_BayesfMRI_initialKP, 6},
-    {"_BayesfMRI_findTheta", (DL_FUNC) &_BayesfMRI_findTheta, 10},
+    {"_BayesfMRI_findTheta", (DL_FUNC) &_BayesfMRI_findTheta, 17},
+    {"_BayesfMRI_findThetaStatsCpp", (DL_FUNC) &_BayesfMRI_findThetaStatsCpp, 13},
+    {"_BayesfMRI_readEMCheckpointCpp", (DL_FUNC) &_BayesfMRI_readEMCheckpointCpp, 1},
+    {"_BayesfMRI_crossprodSubjectsCpp", (DL_FUNC) &_BayesfMRI_crossprodSubjectsCpp, 4},
+    {"_BayesfMRI_convolveHRFCpp", (DL_FUNC) &_BayesfMRI_convolveHRFCpp, 6},
+    {"_BayesfMRI_meshAdjacencyCpp", (DL_FUNC) &_BayesfMRI_meshAdjacencyCpp, 2},
+    {"_BayesfMRI_boundaryLayersCpp", (DL_FUNC) &_BayesfMRI_boundaryLayersCpp, 3},
+    {"_BayesfMRI_rcmOrderCpp", (DL_FUNC) &_BayesfMRI_rcmOrderCpp, 1},
+    {"_BayesfMRI_multiGLMCpp", (DL_FUNC) &_BayesfMRI_multiGLMCpp, 5},
+    {"_BayesfMRI_nuisanceRegressionCpp", (DL_FUNC) &_BayesfMRI_nuisanceRegressionCpp, 3},
     {"_BayesfMRI_getSqrtInvCpp", (DL_FUNC) &_BayesfMRI_getSqrtInvCpp, 3},
+    {"_BayesfMRI_getSqrtInvAllCpp", (DL_FUNC) &_BayesfMRI_getSqrtInvAllCpp, 5},
+    {"_BayesfMRI_surfLumpedMassCpp", (DL_FUNC) &_BayesfMRI_surfLumpedMassCpp, 3},
+    {"_BayesfMRI_surfFEMCpp", (DL_FUNC) &_BayesfMRI_surfFEMCpp, 3},
+    {"_BayesfMRI_traceProbeCpp", (DL_FUNC) &_BayesfMRI_traceProbeCpp, 1},
+    {"_BayesfMRI_vol2spdeCpp", (DL_FUNC) &_BayesfMRI_vol2spdeCpp, 5},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,385 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <fstream>
+#include <cmath>
+#include <limits>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+// Defined in nuisance_regression.cpp, crossprod_Xpsi.cpp and prewhiten.cpp.
+Eigen::MatrixXd nuisRegShared(const Eigen::Map<Eigen::MatrixXd> &Y,
+                              const Eigen::Map<const Eigen::MatrixXd> &X);
+Eigen::MatrixXd nuisRegPerLoc(const Eigen::Map<Eigen::MatrixXd> &Y,
+                              const double *X, int nK, int n_threads, int first);
+void scatterXpsi(const Eigen::MatrixXd &Gram, const Eigen::MatrixXd &Xty,
+                 const Eigen::Map<Eigen::SparseMatrix<double> > &A_sparse,
+                 const Rcpp::LogicalVector &valid_cols,
+                 Eigen::SparseMatrix<double> &XpsiXpsi, Eigen::VectorXd &XpsiY);
+Eigen::SparseMatrix<double> getSqrtInvCpp(Eigen::VectorXd AR_coefs, int nTime, double avg_var);
+template <typename Scalar>
+Eigen::SparseMatrix<Scalar> sqrtInvBand(const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> &AR_coefs,
+                                        int nTime, Scalar avg_var);
+
+/*
+ Open the T x V column-major binary file of doubles at path, and check that
+ its size matches. Locations are then read in order, chunk by chunk.
+ */
+void openBOLD(const std::string &path, int nT, int nV, std::ifstream &in) {
+  in.open(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) { Rcpp::stop("Could not open `BOLD_file`."); }
+  in.seekg(0, std::ios::end);
+  std::streamoff expected = (std::streamoff) nT * nV * sizeof(double);
+  if (in.tellg() != expected) {
+    Rcpp::stop("The size of `BOLD_file` does not match a T x V matrix of doubles.");
+  }
+  in.seekg(0, std::ios::beg);
+}
+
+/*
+ Read the next n_cols locations (n_cols * T doubles) into buf.
+ */
+void readBOLDChunk(std::ifstream &in, int nT, int n_cols, std::vector<double> &buf) {
+  std::streamsize n_bytes = (std::streamsize) nT * n_cols * sizeof(double);
+  in.read(reinterpret_cast<char *>(buf.data()), n_bytes);
+  if (in.gcount() != n_bytes) { Rcpp::stop("Could not read `BOLD_file`."); }
+}
+
+/*
+ Yule-Walker AR fit to x, as in stats::ar.yw(x, aic = aic, order.max = p): the
+ series is demeaned, the autocovariances are solved by Levinson-Durbin, and if
+ aic the order with the smallest AIC is kept. phi receives the p coefficients
+ (zero beyond the order) and var the residual variance.
+ */
+void yuleWalker(const double *x, int n, int p, bool aic,
+                double *phi, double &var, int &order) {
+  double m = 0.;
+  for (int t = 0; t < n; t++) { m += x[t]; }
+  m /= n;
+  std::vector<double> r(p + 1, 0.);
+  for (int k = 0; k <= p; k++) {
+    for (int t = 0; t < n - k; t++) { r[k] += (x[t] - m) * (x[t + k] - m); }
+    r[k] /= n;
+  }
+  // coefs[l] holds the order-(l+1) coefficients; vars[l] the innovation variance.
+  std::vector<std::vector<double> > coefs(p);
+  std::vector<double> vars(p + 1);
+  vars[0] = r[0];
+  for (int l = 1; l <= p; l++) {
+    double num = r[l];
+    for (int j = 1; j < l; j++) { num -= coefs[l - 2][j - 1] * r[l - j]; }
+    double kappa = num / vars[l - 1];
+    coefs[l - 1].resize(l);
+    coefs[l - 1][l - 1] = kappa;
+    for (int j = 1; j < l; j++) {
+      coefs[l - 1][j - 1] = coefs[l - 2][j - 1] - kappa * coefs[l - 2][l - j - 1];
+    }
+    vars[l] = vars[l - 1] * (1. - kappa * kappa);
+  }
+  order = p;
+  if (aic) {
+    double best = std::numeric_limits<double>::infinity();
+    for (int l = 0; l <= p; l++) {
+      double xaic = n * std::log(vars[l]) + 2. * l;
+      if (xaic < best) { best = xaic; order = l; }
+    }
+  }
+  for (int j = 0; j < p; j++) { phi[j] = j < order ? coefs[order - 1][j] : 0.; }
+  var = vars[order] * n / (double) (n - (order + 1));
+}
+
+/*
+ The design of a streamed fit: a T x K matrix shared by all locations, a
+ T x K x V array of per-location design matrices in memory, or the path to a
+ binary file holding that array as doubles in column-major order. A file is
+ read chunk by chunk along with the BOLD data, so that a per-location design
+ is not held in memory in full either.
+ */
+struct StreamDesign {
+  int nT, nK;
+  bool per_location, from_file;
+  Rcpp::NumericVector mem;
+  std::ifstream in;
+  std::vector<double> buf;
+};
+
+/*
+ Check the design against the data dimensions and open it. For a file, T is
+ taken from the size of the BOLD file and K from the size of the design file.
+ */
+void openStreamDesign(SEXP design, const std::string &BOLD_file, int nV,
+                      int chunk_size, StreamDesign &d) {
+  d.from_file = Rf_isString(design);
+  if (d.from_file) {
+    std::ifstream bold(BOLD_file.c_str(), std::ios::in | std::ios::binary);
+    if (!bold) { Rcpp::stop("Could not open `BOLD_file`."); }
+    bold.seekg(0, std::ios::end);
+    std::streamoff per_T = (std::streamoff) nV * sizeof(double);
+    if (bold.tellg() == 0 || bold.tellg() % per_T != 0) {
+      Rcpp::stop("The size of `BOLD_file` does not match a T x V matrix of doubles.");
+    }
+    d.nT = bold.tellg() / per_T;
+    std::string path = Rcpp::as<std::string>(design);
+    d.in.open(path.c_str(), std::ios::in | std::ios::binary);
+    if (!d.in) { Rcpp::stop("Could not open the `design` file."); }
+    d.in.seekg(0, std::ios::end);
+    std::streamoff per_K = (std::streamoff) d.nT * nV * sizeof(double);
+    if (d.in.tellg() == 0 || d.in.tellg() % per_K != 0) {
+      Rcpp::stop("The size of the `design` file does not match a T x K x V array of doubles.");
+    }
+    d.nK = d.in.tellg() / per_K;
+    d.in.seekg(0, std::ios::beg);
+    d.per_location = true;
+    d.buf.resize((std::size_t) d.nT * d.nK * std::min(chunk_size, nV));
+    return;
+  }
+  d.mem = Rcpp::NumericVector(design);
+  Rcpp::IntegerVector dims = d.mem.attr("dim");
+  if (dims.size() < 2 || dims.size() > 3) {
+    Rcpp::stop("`design` must be a matrix, a three-dimensional array or a file path.");
+  }
+  d.nT = dims[0];
+  d.nK = dims[1];
+  d.per_location = dims.size() == 3;
+  if (d.per_location && dims[2] != nV) {
+    Rcpp::stop("The third dimension of `design` must match `nV`.");
+  }
+}
+
+/*
+ The design matrices of the nc locations starting at first, as contiguous
+ T x K blocks, or the shared design. Chunks must be requested in order.
+ */
+const double *streamDesignChunk(StreamDesign &d, int first, int nc) {
+  if (!d.per_location) { return d.mem.begin(); }
+  if (!d.from_file) { return d.mem.begin() + (std::ptrdiff_t) first * d.nT * d.nK; }
+  std::streamsize n_bytes = (std::streamsize) d.nT * d.nK * nc * sizeof(double);
+  d.in.read(reinterpret_cast<char *>(d.buf.data()), n_bytes);
+  if (d.in.gcount() != n_bytes) { Rcpp::stop("Could not read the `design` file."); }
+  return d.buf.data();
+}
+
+/*
+ Copy the columns keep of each of the n_blocks T x K blocks of X into out,
+ and return it.
+ */
+const double *selectColumns(const double *X, int nT, int nK, int n_blocks,
+                            const std::vector<int> &keep, std::vector<double> &out) {
+  int nKv = keep.size();
+  out.resize((std::size_t) nT * nKv * n_blocks);
+  for (int b = 0; b < n_blocks; b++) {
+    for (int j = 0; j < nKv; j++) {
+      std::copy(X + ((std::ptrdiff_t) b * nK + keep[j]) * nT,
+                X + ((std::ptrdiff_t) b * nK + keep[j] + 1) * nT,
+                out.begin() + ((std::ptrdiff_t) b * nKv + j) * nT);
+    }
+  }
+  return out.data();
+}
+
+//' Streaming residual AR estimation from an on-disk BOLD matrix
+//'
+//' Reads the \eqn{T \times V} column-major matrix of doubles in
+//'   \code{BOLD_file} in chunks of \code{chunk_size} locations. Each chunk is
+//'   residualized against the modeled columns of the design and an AR model is
+//'   fit to each residual series before the next chunk is read, so only one
+//'   chunk of the BOLD data, and of a per-location design read from a file,
+//'   is in memory at a time.
+//'
+//' @param BOLD_file path to the binary file
+//' @param nV the number of locations (columns) in the file
+//' @param design the \eqn{T \times K} design matrix, the
+//'   \eqn{T \times K \times V} array of per-location design matrices, or
+//'   the path to a binary file holding that array as doubles in column-major
+//'   order
+//' @param valid_cols logical vector of length \eqn{K}; the design columns
+//'   that are \code{FALSE} are not regressed out
+//' @param ar_order the AR model order. If \code{0}, only the residual variance
+//'   is computed.
+//' @param aic select the order between zero and \code{ar_order} by AIC?
+//' @param chunk_size the number of locations read at a time
+//' @param n_threads the number of threads to use
+//'
+//' @return A list with the \eqn{V \times p} AR coefficients \code{phi}, the
+//'   residual variances \code{sigma_sq}, and the selected orders \code{aic}.
+//'
+// [[Rcpp::export(.boldStreamARCpp, rng = false)]]
+Rcpp::List boldStreamARCpp(std::string BOLD_file, int nV, SEXP design,
+                           const Rcpp::LogicalVector valid_cols,
+                           int ar_order, bool aic, int chunk_size, int n_threads = 1) {
+  if (chunk_size < 1) { Rcpp::stop("`chunk_size` must be positive."); }
+  StreamDesign d;
+  openStreamDesign(design, BOLD_file, nV, chunk_size, d);
+  int nT = d.nT, nK = d.nK;
+  if (valid_cols.size() != nK) {
+    Rcpp::stop("`valid_cols` must have one entry per design column.");
+  }
+  std::vector<int> keep;
+  for (int k = 0; k < nK; k++) { if (valid_cols[k]) { keep.push_back(k); } }
+  int nKv = keep.size();
+  if (nKv == 0) { Rcpp::stop("No design column is modeled."); }
+  if (ar_order < 0 || ar_order >= nT - 1) { Rcpp::stop("`ar_order` is invalid."); }
+  n_threads = nThreads(n_threads);
+  EigenThreads eigen_threads(n_threads);
+
+  std::ifstream in;
+  openBOLD(BOLD_file, nT, nV, in);
+  std::vector<double> buf((std::size_t) nT * std::min(chunk_size, nV));
+  Eigen::MatrixXd phi(nV, ar_order);
+  Eigen::VectorXd sigma_sq(nV);
+  Rcpp::IntegerVector order(nV);
+  std::vector<int> order_v(nV);
+  std::vector<double> X_vc;
+
+  for (int first = 0; first < nV; first += chunk_size) {
+    int nc = std::min(chunk_size, nV - first);
+    readBOLDChunk(in, nT, nc, buf);
+    const double *Xc = streamDesignChunk(d, first, nc);
+    if (nKv < nK) { Xc = selectColumns(Xc, nT, nK, d.per_location ? nc : 1, keep, X_vc); }
+    Eigen::Map<Eigen::MatrixXd> Y(buf.data(), nT, nc);
+    Eigen::MatrixXd R = d.per_location ?
+      nuisRegPerLoc(Y, Xc, nKv, n_threads, first) :
+      nuisRegShared(Y, Eigen::Map<const Eigen::MatrixXd>(Xc, nT, nKv));
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+    {
+      std::vector<double> phi_v(ar_order);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (int c = 0; c < nc; c++) {
+        int v = first + c;
+        const double *r = R.col(c).data();
+        if (std::isnan(r[0])) {
+          phi.row(v).setConstant(NA_REAL);
+          sigma_sq(v) = NA_REAL;
+          order_v[v] = NA_INTEGER;
+          continue;
+        }
+        if (ar_order == 0) {
+          sigma_sq(v) = (R.col(c).array() - R.col(c).mean()).square().sum() / (nT - 1);
+          order_v[v] = 0;
+          continue;
+        }
+        yuleWalker(r, nT, ar_order, aic, phi_v.data(), sigma_sq(v), order_v[v]);
+        for (int j = 0; j < ar_order; j++) { phi(v, j) = phi_v[j]; }
+      }
+    }
+  }
+
+  for (int v = 0; v < nV; v++) { order[v] = order_v[v]; }
+  return Rcpp::List::create(Named("phi") = phi,
+                            Named("sigma_sq") = sigma_sq,
+                            Named("aic") = order);
+}
+
+//' Streaming prewhitened cross-products from an on-disk BOLD matrix
+//'
+//' Computes \code{crossprod(XA)}, \code{crossprod(XA, y)} and
+//'   \code{crossprod(y)}, where \code{XA} is the prewhitened design after
+//'   multiplication by the data-to-mesh matrix and \code{y} the prewhitened
+//'   data, reading the \eqn{T \times V} column-major matrix of doubles in
+//'   \code{BOLD_file} in chunks of \code{chunk_size} locations. Each location
+//'   of a chunk is prewhitened and reduced to its \eqn{K \times K} Gram
+//'   matrix and \eqn{K}-vector before the next chunk is read, so only one
+//'   chunk of the BOLD data, and of a per-location design read from a file,
+//'   is in memory at a time.
+//'
+//' @param BOLD_file path to the binary file
+//' @param design the \eqn{T \times K} design matrix, the
+//'   \eqn{T \times K \times V} array of per-location design matrices, or
+//'   the path to a binary file holding that array as doubles in column-major
+//'   order
+//' @param A_sparse the \eqn{V \times N} data-to-mesh matrix
+//' @param AR_coefs the \eqn{V \times p} AR coefficients for prewhitening. With
+//'   zero columns, each location is only scaled by its residual SD.
+//' @param avg_var the residual variance of each location
+//' @param valid_cols logical vector of length \eqn{K}; fields that are
+//'   \code{FALSE} are left as empty rows and columns
+//' @param chunk_size the number of locations read at a time
+//' @param n_threads the number of threads to use
+//' @param mixed_precision (logical) Prewhiten each location in single
+//'   precision? The Gram matrices and all sums remain double precision.
+//'
+// [[Rcpp::export(.boldStreamCrossprodCpp, rng = false)]]
+Rcpp::List boldStreamCrossprodCpp(std::string BOLD_file, SEXP design,
+                                  const Eigen::Map<Eigen::SparseMatrix<double> > A_sparse,
+                                  const Eigen::Map<Eigen::MatrixXd> AR_coefs,
+                                  const Eigen::Map<Eigen::VectorXd> avg_var,
+                                  const Rcpp::LogicalVector valid_cols,
+                                  int chunk_size, int n_threads = 1,
+                                  bool mixed_precision = false) {
+  int nV = A_sparse.rows();
+  if (chunk_size < 1) { Rcpp::stop("`chunk_size` must be positive."); }
+  StreamDesign d;
+  openStreamDesign(design, BOLD_file, nV, chunk_size, d);
+  int nT = d.nT, nK = d.nK;
+  if (AR_coefs.rows() != nV || avg_var.size() != nV) {
+    Rcpp::stop("`AR_coefs` and `avg_var` must have one entry per data location.");
+  }
+  if (valid_cols.size() != nK) {
+    Rcpp::stop("`valid_cols` must have one entry per design column.");
+  }
+  n_threads = nThreads(n_threads);
+  int p = AR_coefs.cols();
+
+  std::ifstream in;
+  openBOLD(BOLD_file, nT, nV, in);
+  std::vector<double> buf((std::size_t) nT * std::min(chunk_size, nV));
+  Eigen::MatrixXd Gram(nK * nK, nV);
+  Eigen::MatrixXd Xty(nK, nV);
+  Eigen::VectorXd yy(nV);
+
+  for (int first = 0; first < nV; first += chunk_size) {
+    int nc = std::min(chunk_size, nV - first);
+    readBOLDChunk(in, nT, nc, buf);
+    const double *X = streamDesignChunk(d, first, nc);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+    {
+      Eigen::MatrixXd WX(nT, nK), G(nK, nK);
+      Eigen::VectorXd Wy(nT);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (int c = 0; c < nc; c++) {
+        int v = first + c;
+        const double *Xv = d.per_location ? X + (std::ptrdiff_t) c * nT * nK : X;
+        Eigen::Map<const Eigen::MatrixXd> Xmat(Xv, nT, nK);
+        Eigen::Map<const Eigen::VectorXd> y(buf.data() + (std::ptrdiff_t) c * nT, nT);
+        if (p > 0 && mixed_precision) {
+          Eigen::VectorXf AR_v = AR_coefs.row(v).transpose().cast<float>();
+          Eigen::SparseMatrix<float> W = sqrtInvBand<float>(AR_v, nT, (float) avg_var(v));
+          WX = (W * Xmat.cast<float>()).cast<double>();
+          Wy = (W * y.cast<float>()).cast<double>();
+        } else if (p > 0) {
+          Eigen::SparseMatrix<double> W = getSqrtInvCpp(AR_coefs.row(v).transpose(), nT, avg_var(v));
+          WX.noalias() = W * Xmat;
+          Wy.noalias() = W * y;
+        } else {
+          double s = 1. / std::sqrt(avg_var(v));
+          WX = s * Xmat;
+          Wy = s * y;
+        }
+        G.setZero();
+        G.selfadjointView<Eigen::Lower>().rankUpdate(WX.transpose());
+        G.triangularView<Eigen::StrictlyUpper>() = G.transpose();
+        Gram.col(v) = Eigen::Map<Eigen::VectorXd>(G.data(), nK * nK);
+        Xty.col(v).noalias() = WX.transpose() * Wy;
+        yy(v) = Wy.squaredNorm();
+      }
+    }
+  }
+
+  Eigen::SparseMatrix<double> XpsiXpsi;
+  Eigen::VectorXd XpsiY;
+  scatterXpsi(Gram, Xty, A_sparse, valid_cols, XpsiXpsi, XpsiY);
+
+  return Rcpp::List::create(Named("Xcros") = XpsiXpsi,
+                            Named("Xycros") = XpsiY,
+                            Named("yy") = yy.sum());
+}
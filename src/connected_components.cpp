@@ -0,0 +1,95 @@
+#include <Rcpp.h>
+#include <vector>
+
+using namespace Rcpp;
+
+/*
+ Root of vertex i in the union-find forest, halving the path on the way up.
+ */
+int findRoot(std::vector<int> &parent, int i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+/*
+ Merge the sets containing i and j, attaching the smaller tree to the larger.
+ */
+void unionSets(std::vector<int> &parent, std::vector<int> &rank, int i, int j) {
+  int ri = findRoot(parent, i), rj = findRoot(parent, j);
+  if (ri == rj) { return; }
+  if (rank[ri] < rank[rj]) { std::swap(ri, rj); }
+  parent[rj] = ri;
+  if (rank[ri] == rank[rj]) { rank[ri]++; }
+}
+
+//' Connected components of a set of mesh vertices
+//'
+//' Labels the connected components of the active vertices, where two vertices
+//'   are connected if they share a triangle of the mesh. The triangle list is
+//'   read once and the components are found by union-find, so the cost is
+//'   near-linear in the size of the mesh.
+//'
+//' @param tv the \eqn{F \times 3} matrix of (1-based) triangle vertex indices
+//' @param active the (1-based) indices of the active vertices
+//' @param area the area associated with each vertex of the mesh
+//'
+//' @return A list with the component label of each entry of \code{active},
+//'   numbered in order of first appearance, and the \code{size} and
+//'   \code{area} of each component.
+//'
+// [[Rcpp::export(.connectedComponentsCpp, rng = false)]]
+Rcpp::List connectedComponentsCpp(const Rcpp::IntegerMatrix tv,
+                                  const Rcpp::IntegerVector active,
+                                  const Rcpp::NumericVector area) {
+  int nV = area.size();
+  int nF = tv.nrow();
+  if (tv.ncol() != 3) { Rcpp::stop("`tv` must have three columns."); }
+  for (int ii = 0; ii < active.size(); ii++) {
+    if (active[ii] < 1 || active[ii] > nV) { Rcpp::stop("`active` is out of bounds."); }
+  }
+
+  std::vector<char> is_active(nV, 0);
+  for (int ii = 0; ii < active.size(); ii++) { is_active[active[ii] - 1] = 1; }
+
+  // Union the active vertices of each triangle.
+  std::vector<int> parent(nV), rank(nV, 0);
+  for (int i = 0; i < nV; i++) { parent[i] = i; }
+  for (int f = 0; f < nF; f++) {
+    int a = -1;
+    for (int q = 0; q < 3; q++) {
+      int i = tv(f, q) - 1;
+      if (i < 0 || i >= nV) { Rcpp::stop("`tv` is out of bounds."); }
+      if (!is_active[i]) { continue; }
+      if (a < 0) { a = i; } else { unionSets(parent, rank, a, i); }
+    }
+  }
+
+  // Number the components in order of first appearance in `active`.
+  std::vector<int> comp(nV, 0);
+  Rcpp::IntegerVector label(active.size());
+  std::vector<int> size;
+  std::vector<double> comp_area;
+  for (int ii = 0; ii < active.size(); ii++) {
+    int i = active[ii] - 1;
+    int r = findRoot(parent, i);
+    if (comp[r] == 0) {
+      size.push_back(0);
+      comp_area.push_back(0.);
+      comp[r] = size.size();
+    }
+    label[ii] = comp[r];
+    if (is_active[i] == 1) {
+      // Count repeated indices only once.
+      is_active[i] = 2;
+      size[comp[r] - 1]++;
+      comp_area[comp[r] - 1] += area[i];
+    }
+  }
+
+  return Rcpp::List::create(Named("label") = label,
+                            Named("size") = Rcpp::wrap(size),
+                            Named("area") = Rcpp::wrap(comp_area));
+}
@@ -0,0 +1,56 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ Scatter the per-location K x K Gram matrices (columns of Gram, K^2 x V) and
+ K-vectors (columns of Xty, K x V) onto the mesh through the V x N
+ data-to-mesh matrix A, giving crossprod(XA) and crossprod(XA, y) with
+ field-major columns k*N + j. Done serially, in location order, so the result
+ does not depend on the number of threads.
+ */
+void scatterXpsi(const Eigen::MatrixXd &Gram, const Eigen::MatrixXd &Xty,
+                 const Eigen::Map<Eigen::SparseMatrix<double> > &A_sparse,
+                 const Rcpp::LogicalVector &valid_cols,
+                 Eigen::SparseMatrix<double> &XpsiXpsi, Eigen::VectorXd &XpsiY) {
+  int nK = Xty.rows();
+  int nV = Xty.cols();
+  int nMesh = A_sparse.cols();
+  Eigen::SparseMatrix<double> At = A_sparse.transpose();
+  int nKN = nK * nMesh;
+  // Each location adds one triplet per pair of its mesh entries and pair of
+  //   valid fields.
+  int nValid = 0;
+  for (int k = 0; k < nK; k++) { if (valid_cols[k]) { nValid++; } }
+  std::size_t nTrips = 0;
+  for (int v = 0; v < nV; v++) {
+    std::size_t nA = At.outerIndexPtr()[v + 1] - At.outerIndexPtr()[v];
+    nTrips += nA * nA;
+  }
+  std::vector<Eigen::Triplet<double> > trips;
+  trips.reserve(nTrips * nValid * nValid);
+  XpsiY = Eigen::VectorXd::Zero(nKN);
+  for (int v = 0; v < nV; v++) {
+    for (Eigen::SparseMatrix<double>::InnerIterator a1(At, v); a1; ++a1) {
+      for (int k = 0; k < nK; k++) {
+        if (!valid_cols[k]) { continue; }
+        XpsiY(k * nMesh + a1.row()) += a1.value() * Xty(k, v);
+        for (Eigen::SparseMatrix<double>::InnerIterator a2(At, v); a2; ++a2) {
+          double w = a1.value() * a2.value();
+          for (int l = 0; l < nK; l++) {
+            if (!valid_cols[l]) { continue; }
+            trips.push_back(Eigen::Triplet<double>(k * nMesh + a1.row(),
+                                                   l * nMesh + a2.row(),
+                                                   w * Gram(k + l * nK, v)));
+          }
+        }
+      }
+    }
+  }
+  XpsiXpsi.resize(nKN, nKN);
+  XpsiXpsi.setFromTriplets(trips.begin(), trips.end());
+}
@@ -0,0 +1,222 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+#include <cmath>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+// Defined in bold_stream.cpp and crossprod_Xpsi.cpp.
+void checkStreamDesign(const Rcpp::NumericVector &design, int nV,
+                       int &nT, int &nK, bool &per_location);
+void scatterXpsi(const Eigen::MatrixXd &Gram, const Eigen::MatrixXd &Xty,
+                 const Eigen::Map<Eigen::SparseMatrix<double> > &A_sparse,
+                 const Rcpp::LogicalVector &valid_cols,
+                 Eigen::SparseMatrix<double> &XpsiXpsi, Eigen::VectorXd &XpsiY);
+
+/*
+ The first n_rows prewhitened rows of the L x C segment Z of a series, for AR
+ coefficients phi (length p) and innovation SD sd: row j is
+ (Z_j - sum_k phi_k Z_{j+k}) / sd, dropping the terms beyond the segment. These
+ are the rows of H'D, where D H H' D is the AR precision that .getSqrtInvCpp
+ takes the square root of, so the cross-products of all the rows of a series
+ are those of the prewhitened series. Row j only depends on volumes j to j+p,
+ so it is final once volume j+p has arrived.
+ */
+Eigen::MatrixXd whitenRows(const Eigen::MatrixXd &Z, const double *phi, int p,
+                           double sd, int n_rows) {
+  int L = Z.rows();
+  Eigen::MatrixXd W = Z.topRows(n_rows);
+  for (int j = 0; j < n_rows; j++) {
+    for (int k = 1; k <= p && j + k < L; k++) { W.row(j) -= phi[k - 1] * Z.row(j + k); }
+  }
+  return W / sd;
+}
+
+/*
+ Add the cross-products of the prewhitened rows WZ (design columns, then the
+ response in the last column) to those of location v.
+ */
+void addRowsCrossprod(const Eigen::MatrixXd &WZ, int nK, int v,
+                      Eigen::MatrixXd &Gram, Eigen::MatrixXd &Xty, Eigen::VectorXd &yy) {
+  if (WZ.rows() == 0) { return; }
+  Eigen::MatrixXd G = WZ.leftCols(nK).transpose() * WZ.leftCols(nK);
+  Gram.col(v) += Eigen::Map<Eigen::VectorXd>(G.data(), nK * nK);
+  Xty.col(v).noalias() += WZ.leftCols(nK).transpose() * WZ.col(nK);
+  yy(v) += WZ.col(nK).squaredNorm();
+}
+
+/*
+ Check the AR parameters of an incremental fit against the number of
+ locations, and return the innovation SD of each location.
+ */
+Eigen::VectorXd checkStatsAR(const Eigen::Map<Eigen::MatrixXd> &AR_coefs,
+                             const Eigen::Map<Eigen::VectorXd> &avg_var, int nV) {
+  if (AR_coefs.rows() != nV || avg_var.size() != nV) {
+    Rcpp::stop("`AR_coefs` and `avg_var` must have one entry per data location.");
+  }
+  return avg_var.array().sqrt().matrix();
+}
+
+//' Update the sufficient statistics of the Bayesian GLM with new volumes
+//'
+//' Adds a block of volumes of a single session to the prewhitened
+//'   per-location cross-products from which \code{.emStatsCrossprodCpp} forms
+//'   the sufficient statistics of the EM, in time proportional to the number
+//'   of new volumes times the number of locations. Prewhitening uses the AR
+//'   precision of \code{.getSqrtInvCpp}, factored so that each prewhitened
+//'   row depends only on the next \eqn{p} volumes; the last \eqn{p} volumes,
+//'   whose rows are not yet final, are carried over to the next update.
+//'
+//' @param stats the result of the previous update, or \code{NULL} for the
+//'   first block of the session
+//' @param BOLD the \eqn{T_b \times V} data matrix of the new volumes
+//' @param design the \eqn{T_b \times K} design matrix of the new volumes, or
+//'   the \eqn{T_b \times K \times V} array of per-location design matrices
+//' @param AR_coefs the \eqn{V \times p} AR coefficients for prewhitening, which
+//'   must be the same at every update. With zero columns, each location is
+//'   only scaled by its residual SD.
+//' @param avg_var the residual variance of each location
+//' @param n_threads the number of threads to use
+//'
+//' @return A list with the per-location cross-products \code{Gram}
+//'   (\eqn{K^2 \times V}), \code{Xty} (\eqn{K \times V}) and \code{yy} of the
+//'   final rows, the number of volumes \code{nT} so far, and the volumes
+//'   carried over, \code{y_tail} and \code{X_tail}.
+//'
+// [[Rcpp::export(.emStatsUpdateCpp, rng = false)]]
+Rcpp::List emStatsUpdateCpp(Rcpp::Nullable<Rcpp::List> stats,
+                            const Eigen::Map<Eigen::MatrixXd> BOLD,
+                            const Rcpp::NumericVector design,
+                            const Eigen::Map<Eigen::MatrixXd> AR_coefs,
+                            const Eigen::Map<Eigen::VectorXd> avg_var,
+                            int n_threads = 1) {
+  int nV = BOLD.cols();
+  int nT, nK;
+  bool per_location;
+  checkStreamDesign(design, nV, nT, nK, per_location);
+  if (BOLD.rows() != nT) { Rcpp::stop("`BOLD` and `design` must have the same number of volumes."); }
+  Eigen::VectorXd sd = checkStatsAR(AR_coefs, avg_var, nV);
+  n_threads = nThreads(n_threads);
+  int p = AR_coefs.cols();
+  int nD = per_location ? nV : 1;
+
+  // The statistics so far, or empty ones for the first block.
+  Eigen::MatrixXd Gram = Eigen::MatrixXd::Zero(nK * nK, nV);
+  Eigen::MatrixXd Xty = Eigen::MatrixXd::Zero(nK, nV);
+  Eigen::VectorXd yy = Eigen::VectorXd::Zero(nV);
+  Eigen::MatrixXd y_tail(0, nV), X_tail(0, nK * nD);
+  int nT_prev = 0;
+  if (stats.isNotNull()) {
+    Rcpp::List st(stats);
+    Gram = Rcpp::as<Eigen::MatrixXd>(st["Gram"]);
+    Xty = Rcpp::as<Eigen::MatrixXd>(st["Xty"]);
+    yy = Rcpp::as<Eigen::VectorXd>(st["yy"]);
+    nT_prev = Rcpp::as<int>(st["nT"]);
+    y_tail = Rcpp::as<Eigen::MatrixXd>(st["y_tail"]);
+    X_tail = Rcpp::as<Eigen::MatrixXd>(st["X_tail"]);
+    if (Gram.rows() != nK * nK || Gram.cols() != nV || Xty.rows() != nK) {
+      Rcpp::stop("`stats` does not match the dimensions of `BOLD` and `design`.");
+    }
+    if (y_tail.rows() != std::min(nT_prev, p) || y_tail.cols() != nV ||
+        X_tail.rows() != y_tail.rows() || X_tail.cols() != nK * nD) {
+      Rcpp::stop("`stats` does not match `AR_coefs` or the type of `design`.");
+    }
+  }
+
+  // Each location: the carried-over volumes and the new ones form a segment,
+  // whose first rows are now final; its last p volumes are carried over.
+  int nq = y_tail.rows(), L = nq + nT;
+  int n_final = std::max(0, L - p), n_tail = std::min(L, p);
+  Eigen::MatrixXd y_tail_new(n_tail, nV), X_tail_new(n_tail, nK * nD);
+  const double *X = design.begin();
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+  {
+    Eigen::MatrixXd Z(L, nK + 1);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int v = 0; v < nV; v++) {
+      int d = per_location ? v : 0;
+      Eigen::Map<const Eigen::MatrixXd> Xv(X + (std::ptrdiff_t) d * nT * nK, nT, nK);
+      Z.topLeftCorner(nq, nK) = X_tail.middleCols(d * nK, nK);
+      Z.bottomLeftCorner(nT, nK) = Xv;
+      Z.col(nK).head(nq) = y_tail.col(v);
+      Z.col(nK).tail(nT) = BOLD.col(v);
+      Eigen::VectorXd phi_v = AR_coefs.row(v).transpose();
+      addRowsCrossprod(whitenRows(Z, phi_v.data(), p, sd(v), n_final), nK, v, Gram, Xty, yy);
+      y_tail_new.col(v) = Z.col(nK).tail(n_tail);
+      if (per_location || v == 0) {
+        X_tail_new.middleCols(d * nK, nK) = Z.bottomLeftCorner(n_tail, nK);
+      }
+    }
+  }
+
+  return Rcpp::List::create(Named("Gram") = Gram,
+                            Named("Xty") = Xty,
+                            Named("yy") = yy,
+                            Named("nT") = nT_prev + nT,
+                            Named("y_tail") = y_tail_new,
+                            Named("X_tail") = X_tail_new);
+}
+
+//' Sufficient statistics of the Bayesian GLM from incremental updates
+//'
+//' Completes the per-location cross-products of \code{.emStatsUpdateCpp}
+//'   with the rows of the volumes carried over, truncated at the end of the
+//'   series as in \code{.getSqrtInvCpp}, and scatters them onto the mesh as
+//'   \code{.boldStreamCrossprodCpp} does. The result is the input to
+//'   \code{.findThetaStatsCpp} for all the volumes so far.
+//'
+//' @param stats the result of \code{.emStatsUpdateCpp}
+//' @param A_sparse the \eqn{V \times N} data-to-mesh matrix
+//' @param AR_coefs,avg_var the prewhitening parameters used for the updates
+//' @param valid_cols logical vector of length \eqn{K}; fields that are
+//'   \code{FALSE} are left as empty rows and columns
+//'
+//' @return A list with \code{Xcros}, \code{Xycros} and \code{yy} as in
+//'   \code{.boldStreamCrossprodCpp}, and the number of observations \code{n_obs}.
+//'
+// [[Rcpp::export(.emStatsCrossprodCpp, rng = false)]]
+Rcpp::List emStatsCrossprodCpp(const Rcpp::List stats,
+                               const Eigen::Map<Eigen::SparseMatrix<double> > A_sparse,
+                               const Eigen::Map<Eigen::MatrixXd> AR_coefs,
+                               const Eigen::Map<Eigen::VectorXd> avg_var,
+                               const Rcpp::LogicalVector valid_cols) {
+  Eigen::MatrixXd Gram = Rcpp::as<Eigen::MatrixXd>(stats["Gram"]);
+  Eigen::MatrixXd Xty = Rcpp::as<Eigen::MatrixXd>(stats["Xty"]);
+  Eigen::VectorXd yy = Rcpp::as<Eigen::VectorXd>(stats["yy"]);
+  Eigen::MatrixXd y_tail = Rcpp::as<Eigen::MatrixXd>(stats["y_tail"]);
+  Eigen::MatrixXd X_tail = Rcpp::as<Eigen::MatrixXd>(stats["X_tail"]);
+  int nT = Rcpp::as<int>(stats["nT"]);
+  int nK = Xty.rows(), nV = Xty.cols();
+  if (A_sparse.rows() != nV) { Rcpp::stop("`A_sparse` must have one row per data location."); }
+  if (valid_cols.size() != nK) { Rcpp::stop("`valid_cols` must have one entry per design column."); }
+  Eigen::VectorXd sd = checkStatsAR(AR_coefs, avg_var, nV);
+  int p = AR_coefs.cols();
+  int nq = y_tail.rows();
+  bool per_location = X_tail.cols() == nK * nV;
+
+  // The carried-over rows are short, so this loop is serial.
+  Eigen::MatrixXd Z(nq, nK + 1);
+  for (int v = 0; v < nV; v++) {
+    int d = per_location ? v : 0;
+    Z.leftCols(nK) = X_tail.middleCols(d * nK, nK);
+    Z.col(nK) = y_tail.col(v);
+    Eigen::VectorXd phi_v = AR_coefs.row(v).transpose();
+    addRowsCrossprod(whitenRows(Z, phi_v.data(), p, sd(v), nq), nK, v, Gram, Xty, yy);
+  }
+
+  Eigen::SparseMatrix<double> XpsiXpsi;
+  Eigen::VectorXd XpsiY;
+  scatterXpsi(Gram, Xty, A_sparse, valid_cols, XpsiXpsi, XpsiY);
+
+  return Rcpp::List::create(Named("Xcros") = XpsiXpsi,
+                            Named("Xycros") = XpsiY,
+                            Named("yy") = yy.sum(),
+                            Named("n_obs") = (double) nT * nV);
+}
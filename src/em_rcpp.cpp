@@ -1,6 +1,9 @@
 #define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
 #include <Rcpp.h>
 #include <RcppEigen.h>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
 
 using namespace Rcpp;
 using namespace Eigen;
@@ -284,6 +287,96 @@ struct SquaremOutput{
   bool convergence=false;
 } sqobj,sqobjnull;
 
+//Loop state of theta_squarem2, at the top of an iteration
+struct SquaremState{
+  Eigen::VectorXd par;//current iterate
+  Eigen::VectorXd par_prev;//previous iterate
+  double stepmin=1;
+  double stepmax=1;
+  int iter=1;
+  int feval=0;
+};
+
+/*
+ EM checkpoints. A checkpoint is a small binary file holding the SQUAREM loop
+ state at the top of an iteration, and the state of R's random number
+ generator (which draws the Hutchinson probes), so that the loop resumes
+ exactly where it left off:
+   "BFMRIEM1", n_par, nKs, Ns (int32),
+   par, par_prev (n_par doubles each), stepmin, stepmax (double),
+   iter, feval, n_seed (int32), .Random.seed (n_seed int32).
+ nKs and Ns identify the problem the checkpoint belongs to. The file is
+ written to a temporary path and renamed, so a run that is interrupted while
+ writing leaves the previous checkpoint intact.
+ */
+const char EM_CHECKPOINT_MAGIC[9] = "BFMRIEM1";
+
+void writeEMCheckpoint(const std::string &path, const SquaremState &state, int nKs, int Ns) {
+  // Sync the RNG state used by the probes to .Random.seed, and copy it.
+  PutRNGstate();
+  Rcpp::Environment g = Rcpp::Environment::global_env();
+  Rcpp::IntegerVector seed(0);
+  if (g.exists(".Random.seed")) { seed = g[".Random.seed"]; }
+  int n_par = state.par.size(), n_seed = seed.size();
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out) { Rcpp::stop("Could not write the EM checkpoint."); }
+  out.write(EM_CHECKPOINT_MAGIC, 8);
+  out.write((const char *) &n_par, sizeof(int));
+  out.write((const char *) &nKs, sizeof(int));
+  out.write((const char *) &Ns, sizeof(int));
+  out.write((const char *) state.par.data(), n_par * sizeof(double));
+  out.write((const char *) state.par_prev.data(), n_par * sizeof(double));
+  out.write((const char *) &state.stepmin, sizeof(double));
+  out.write((const char *) &state.stepmax, sizeof(double));
+  out.write((const char *) &state.iter, sizeof(int));
+  out.write((const char *) &state.feval, sizeof(int));
+  out.write((const char *) &n_seed, sizeof(int));
+  out.write((const char *) seed.begin(), n_seed * sizeof(int));
+  out.close();
+  if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    Rcpp::stop("Could not write the EM checkpoint.");
+  }
+}
+
+void readEMCheckpoint(const std::string &path, SquaremState &state,
+                      int &nKs, int &Ns, Rcpp::IntegerVector &seed) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) { Rcpp::stop("Could not open the EM checkpoint."); }
+  char magic[8];
+  int n_par, n_seed;
+  in.read(magic, 8);
+  if (!in || std::string(magic, 8) != EM_CHECKPOINT_MAGIC) {
+    Rcpp::stop("The file is not an EM checkpoint.");
+  }
+  in.read((char *) &n_par, sizeof(int));
+  in.read((char *) &nKs, sizeof(int));
+  in.read((char *) &Ns, sizeof(int));
+  if (!in || n_par < 1) { Rcpp::stop("The EM checkpoint is corrupt."); }
+  state.par.resize(n_par);
+  state.par_prev.resize(n_par);
+  in.read((char *) state.par.data(), n_par * sizeof(double));
+  in.read((char *) state.par_prev.data(), n_par * sizeof(double));
+  in.read((char *) &state.stepmin, sizeof(double));
+  in.read((char *) &state.stepmax, sizeof(double));
+  in.read((char *) &state.iter, sizeof(int));
+  in.read((char *) &state.feval, sizeof(int));
+  in.read((char *) &n_seed, sizeof(int));
+  if (!in || n_seed < 0) { Rcpp::stop("The EM checkpoint is corrupt."); }
+  seed = Rcpp::IntegerVector(n_seed);
+  in.read((char *) seed.begin(), n_seed * sizeof(int));
+  if (!in) { Rcpp::stop("The EM checkpoint is corrupt."); }
+}
+
+Rcpp::List stateToList(const SquaremState &state) {
+  return List::create(Named("theta") = state.par,
+                      Named("theta_prev") = state.par_prev,
+                      Named("stepmin") = state.stepmin,
+                      Named("stepmax") = state.stepmax,
+                      Named("iter") = state.iter,
+                      Named("feval") = state.feval);
+}
+
 Eigen::VectorXd init_fixptC(Eigen::VectorXd theta, Eigen::VectorXd w, List spde, double n_sess) {
   int n_spde = w.size();
   int start_idx;
@@ -466,8 +559,9 @@ Eigen::VectorXd initialKP(Eigen::VectorXd theta, List spde, Eigen::VectorXd w,
   return theta;
 }
 
-Eigen::MatrixXd makeV(int n_spde, int Ns) {
-  Eigen::MatrixXd V(n_spde,Ns);
+template <typename Scalar>
+Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> makeV(int n_spde, int Ns) {
+  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> V(n_spde,Ns);
   Rcpp::NumericVector x(1);
   for(int i = 0; i < n_spde; i++) {
     for(int j = 0; j < Ns; j++) {
@@ -483,6 +577,49 @@ Eigen::MatrixXd makeV(int n_spde, int Ns) {
   return V;
 }
 
+/*
+ Mixed-precision probe solves: P = Sig_inv^{-1} V for float32 probes V, using
+ the float64 factorization. Solved a few columns at a time in float64, and
+ stored in float32, so no full float64 copy of the probe block is formed.
+ */
+void probeSolveF(SimplicialLLT<Eigen::SparseMatrix<double> > &cholSigInv,
+                 const Eigen::MatrixXf &V, Eigen::MatrixXf &P) {
+  const int block = 8;
+  P.resize(V.rows(), V.cols());
+  for (int j = 0; j < V.cols(); j += block) {
+    int nb = std::min(block, (int) V.cols() - j);
+    Eigen::MatrixXd Vd = V.middleCols(j, nb).cast<double>();
+    P.middleCols(j, nb) = cholSigInv.solve(Vd).cast<float>();
+  }
+}
+
+/*
+ The trace of P'Q for float32 blocks P and Q, accumulated in float64.
+ */
+double traceProdF(const Eigen::Ref<const Eigen::MatrixXf> &P,
+                  const Eigen::Ref<const Eigen::MatrixXf> &Q) {
+  double tr = 0.;
+  for (int j = 0; j < P.cols(); j++) {
+    for (int i = 0; i < P.rows(); i++) { tr += (double) P(i, j) * Q(i, j); }
+  }
+  return tr;
+}
+
+/*
+ Float32 copies of A and of the SPDE matrices for the mixed-precision trace
+ estimates, cast once per fit and shared by all its fixed-point evaluations.
+ */
+struct FloatMats {
+  Eigen::SparseMatrix<float> A, Cmat, Gmat, GtCinvG;
+};
+
+void makeFloatMats(const Eigen::SparseMatrix<double> &A, const List &spde, FloatMats &F) {
+  F.A = A.cast<float>();
+  F.Cmat = Eigen::SparseMatrix<double>(spde["Cmat"]).cast<float>();
+  F.Gmat = Eigen::SparseMatrix<double>(spde["Gmat"]).cast<float>();
+  F.GtCinvG = Eigen::SparseMatrix<double>(spde["GtCinvG"]).cast<float>();
+}
+
 /*
  B of size n1 x n2
  Set A(i:i+n1,j:j+n2) = B (update)
@@ -496,6 +633,25 @@ void setSparseBlock_update(SparseMatrix<double,0,int>* A,int i, int j, SparseMat
   }
 }
 
+/*
+ Set the diagonal blocks of the prior precision QK, one per field and
+ session, to Q(kappa2_k) / (4 pi phi_k) at theta.
+ */
+void updateQK(Eigen::SparseMatrix<double>* QK, const Eigen::VectorXd &theta, const List &spde) {
+  int K = (theta.size() - 1) / 2;
+  int n_spde = Eigen::SparseMatrix<double>(spde["Cmat"]).rows();
+  int n_sess = QK->rows() / (n_spde * K);
+  Eigen::SparseMatrix<double> Qk(n_spde, n_spde);
+  for(int k = 0; k < K ; k++) {
+    makeQt(&Qk, theta(k), spde);
+    Qk = Qk / (4.0 * M_PI * theta(k + K));
+    for(int ns = 0; ns < n_sess; ns++) {
+      int start_i = k * n_spde + ns * K * n_spde;
+      setSparseBlock_update(QK, start_i, start_i, Qk);
+    }
+  }
+}
+
 double emObj(Eigen::VectorXd theta, const Eigen::SparseMatrix<double> A,
              Eigen::SparseMatrix<double> QK,
              SimplicialLLT<Eigen::SparseMatrix<double> > &cholSigInv,
@@ -512,7 +668,7 @@ double emObj(Eigen::VectorXd theta, const Eigen::SparseMatrix<double> A,
   int ySize = y.size();
   int n_spde = Cmat.rows();
   double n_sess = nKs / (n_spde * K);
-  Eigen::MatrixXd Vh = makeV(nKs,Ns);
+  Eigen::MatrixXd Vh = makeV<double>(nKs,Ns);
   // Initialize objects
   Eigen::SparseMatrix<double> AdivS2(nKs,nKs), Sig_inv(nKs,nKs), Qk(n_spde, n_spde);
   for(int k = 0; k < K ; k++) {
@@ -550,9 +706,12 @@ double emObj(Eigen::VectorXd theta, const Eigen::SparseMatrix<double> A,
 
 Eigen::VectorXd theta_fixpt(Eigen::VectorXd theta, const Eigen::SparseMatrix<double> A,
                             Eigen::SparseMatrix<double> QK, SimplicialLLT<Eigen::SparseMatrix<double> > &cholSigInv,
-                            const Eigen::VectorXd XpsiY, const Eigen::SparseMatrix<double> Xpsi,
-                            const int Ns, const Eigen::VectorXd y,
-                            const double yy, const List spde, double tol) {
+                            const Eigen::VectorXd XpsiY, const int Ns,
+                            const double yy, const double n_obs, const List spde, double tol,
+                            bool mixed_precision, const FloatMats &Fm) {
+  // The data only enter through XpsiY = Xpsi'y, A = Xpsi'Xpsi, yy = y'y and
+  // the number of observations n_obs, so the fixed point can be evaluated
+  // from accumulated sufficient statistics.
   // Bring in the spde matrices
   Eigen::SparseMatrix<double> Cmat     = Eigen::SparseMatrix<double> (spde["Cmat"]);
   Eigen::SparseMatrix<double> Gmat     = Eigen::SparseMatrix<double> (spde["Gmat"]);
@@ -561,13 +720,22 @@ Eigen::VectorXd theta_fixpt(Eigen::VectorXd theta, const Eigen::SparseMatrix<dou
   int K = (theta.size() - 1) / 2;
   int sig2_ind = theta.size() - 1;
   int nKs = A.rows();
-  int ySize = y.size();
   int n_spde = Cmat.rows();
   double n_sess = nKs / (n_spde * K);
   // int Ns = Vh.cols();
-  Eigen::MatrixXd Vh = makeV(nKs,Ns);
-  // Rcout << "dim(A)" << A.rows() << " x " << A.cols() << ", dim(Vh) = " << Vh.rows() << " x " << Vh.cols() << std::endl;
-  Eigen::MatrixXd Avh = A * Vh;
+  // In mixed precision, the probes, A * probes and the probe solutions are
+  // float32, using the float32 matrices in Fm; the factorization and all
+  // accumulations stay float64.
+  Eigen::MatrixXd Vh, Avh, P;
+  Eigen::MatrixXf Vhf, Avhf, Pf;
+  if (mixed_precision) {
+    Vhf = makeV<float>(nKs,Ns);
+    Avhf = Fm.A * Vhf;
+  } else {
+    Vh = makeV<double>(nKs,Ns);
+    // Rcout << "dim(A)" << A.rows() << " x " << A.cols() << ", dim(Vh) = " << Vh.rows() << " x " << Vh.cols() << std::endl;
+    Avh = A * Vh;
+  }
   // Initialize objects
   Eigen::SparseMatrix<double> AdivS2(nKs,nKs), Sig_inv(nKs,nKs), Qk(n_spde, n_spde);
   Eigen::VectorXd theta_new = theta;
@@ -595,17 +763,22 @@ Eigen::VectorXd theta_fixpt(Eigen::VectorXd theta, const Eigen::SparseMatrix<dou
   Eigen::VectorXd mu = cholSigInv.solve(m);
   // Rcout << "First 6 values of mu: " << mu.segment(0,6).transpose() << std::endl;
   // Solve for sigma_2
-  Eigen::VectorXd XpsiMu = Xpsi * mu;
-  Eigen::MatrixXd P = cholSigInv.solve(Vh);
-  Eigen::MatrixXd PaVh = P.transpose() * Avh;
-  Eigen::VectorXd diagPaVh = PaVh.diagonal();
-  double TrSigA = diagPaVh.sum() / Ns;
+  double TrSigA;
+  if (mixed_precision) {
+    probeSolveF(cholSigInv, Vhf, Pf);
+    TrSigA = traceProdF(Pf, Avhf) / Ns;
+  } else {
+    P = cholSigInv.solve(Vh);
+    Eigen::MatrixXd PaVh = P.transpose() * Avh;
+    Eigen::VectorXd diagPaVh = PaVh.diagonal();
+    TrSigA = diagPaVh.sum() / Ns;
+  }
   Eigen::VectorXd Amu = A * mu;
   double muAmu = mu.transpose() * Amu;
   double TrAEww = muAmu + TrSigA;
   // Rcout << "TrAEww = " << TrAEww << std::endl;
-  double yXpsiMu = y.transpose() * XpsiMu;
-  theta_new[sig2_ind] = (yy - 2 * yXpsiMu + TrAEww) / ySize;
+  double yXpsiMu = XpsiY.dot(mu);
+  theta_new[sig2_ind] = (yy - 2 * yXpsiMu + TrAEww) / n_obs;
   // Update kappa2 and phi by task
   for(int k = 0; k < K; k++) {
     a_star = 0.0;
@@ -630,6 +803,15 @@ Eigen::VectorXd theta_fixpt(Eigen::VectorXd theta, const Eigen::SparseMatrix<dou
       GCGmu = GtCinvG * muKns;
       muGCGmu += muKns.transpose() * GCGmu;
       // Trace approximations w/ Sigma
+      if (mixed_precision) {
+        sumDiagPCVkn += traceProdF(Pf.block(idx_start, 0, n_spde, Ns),
+                                   Fm.Cmat * Vhf.block(idx_start, 0, n_spde, Ns));
+        sumDiagPGVkn += traceProdF(Pf.block(idx_start, 0, n_spde, Ns),
+                                   Fm.Gmat * Vhf.block(idx_start, 0, n_spde, Ns));
+        sumDiagPGCGVkn += traceProdF(Pf.block(idx_start, 0, n_spde, Ns),
+                                     Fm.GtCinvG * Vhf.block(idx_start, 0, n_spde, Ns));
+        continue;
+      }
       Pkn = P.block(idx_start, 0, n_spde, Ns);
       Vkn = Vh.block(idx_start, 0, n_spde, Ns);
       // Trace of C*Sigma
@@ -687,33 +869,52 @@ Eigen::VectorXd theta_fixpt(Eigen::VectorXd theta, const Eigen::SparseMatrix<dou
 
 
 
-SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<double> A,
+SquaremOutput theta_squarem2(const Eigen::SparseMatrix<double> A,
                        Eigen::SparseMatrix<double> QK, SimplicialLLT<Eigen::SparseMatrix<double> > &cholSigInv,
-                       const Eigen::VectorXd XpsiY, const Eigen::SparseMatrix<double> Xpsi,
-                       const int Ns, const Eigen::VectorXd y, const double yy,
-                       const List spde, double tol, bool verbose){
+                       const Eigen::VectorXd XpsiY, const int Ns,
+                       const double yy, const double n_obs,
+                       const List spde, double tol, bool verbose,
+                       bool mixed_precision, SquaremState &state,
+                       const std::string &checkpoint_file = "", int checkpoint_every = 10,
+                       int max_feval = -1){
+  // The loop starts from state (iterate, step bounds and counts), and state
+  // holds the final iterate on return. It stops after max_feval fixed-point
+  // evaluations (SquaremDefault.maxiter if negative), within an iteration if
+  // needed, at the last fixed-point update.
   double res,parnorm,kres;;//, theta_length=par.size(); //unused
-  Eigen::VectorXd pcpp,p1cpp,p2cpp,pnew,ptmp;
+  Eigen::VectorXd pcpp,pprev,p1cpp,p2cpp,pnew,ptmp;
   Eigen::VectorXd q1,q2,sr2,sq2,sv2,srv;
   double sr2_scalar,sq2_scalar,sv2_scalar,srv_scalar,alpha,stepmin,stepmax;
   // double ob_pcpp, ob_p1cpp, ob_p2cpp, ob_ptmp, ob_pnew, rel_llik_pp1, rel_llik_p1p2, rel_llik_tmpNew;
   int iter,feval;
   bool conv,extrap;
-  stepmin=SquaremDefault.stepmin0;
-  stepmax=SquaremDefault.stepmax0;
+  bool do_checkpoint = !checkpoint_file.empty() && checkpoint_every > 0;
+  stepmin=state.stepmin;
+  stepmax=state.stepmax;
   if(verbose){Rcout<<"Squarem-2"<<std::endl;}
 
-  iter=1;pcpp=par;pnew=par;
-  feval=0;conv=true;
+  iter=state.iter;pcpp=state.par;pprev=state.par_prev;pnew=pcpp;
+  feval=state.feval;conv=true;
+  const int iter0=iter;
   // ob_pcpp = emObj(pcpp,A,QK,cholSigInv,XpsiY,Xpsi,Ns,y,spde);
 
   const long int parvectorlength=pcpp.size();
-
-  while(feval<SquaremDefault.maxiter){
+  if(max_feval<0){max_feval=SquaremDefault.maxiter;}
+  FloatMats Fm;
+  if(mixed_precision){makeFloatMats(A, spde, Fm);}
+
+  while(feval<max_feval){
+    //Checkpoint the state at the top of the iteration
+    if(do_checkpoint && iter>iter0 && (iter-iter0)%checkpoint_every==0){
+      state.par=pcpp;state.par_prev=pprev;state.stepmin=stepmin;state.stepmax=stepmax;
+      state.iter=iter;state.feval=feval;
+      writeEMCheckpoint(checkpoint_file, state, A.rows(), Ns);
+      if(verbose){Rcout<<"Checkpoint written at iteration "<<iter<<std::endl;}
+    }
     //Step 1
     extrap = true;
     // try{p1cpp=fixptfn(pcpp);feval++;}
-    try{p1cpp=theta_fixpt(pcpp, A, QK, cholSigInv, XpsiY, Xpsi, Ns, y, yy, spde, tol);feval++;}
+    try{p1cpp=theta_fixpt(pcpp, A, QK, cholSigInv, XpsiY, Ns, yy, n_obs, spde, tol, mixed_precision, Fm);feval++;}
     catch(...){
       Rcout<<"Error in fixptfn function evaluation";
       return sqobjnull;
@@ -730,9 +931,10 @@ SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<doub
     // if(std::sqrt(sr2_scalar)<tol){break;}
     if(std::sqrt(sr2_scalar) / pcpp_norm <tol){break;}
     // if(rel_llik_pp1<tol){break;}
+    if(feval>=max_feval){pprev=pcpp;pcpp=p1cpp;iter++;break;}
 
     //Step 2
-    try{p2cpp=theta_fixpt(p1cpp, A, QK, cholSigInv, XpsiY, Xpsi, Ns, y, yy, spde, tol);feval++;}
+    try{p2cpp=theta_fixpt(p1cpp, A, QK, cholSigInv, XpsiY, Ns, yy, n_obs, spde, tol, mixed_precision, Fm);feval++;}
     catch(...){
       Rcout<<"Error in fixptfn function evaluation";
       return sqobjnull;
@@ -769,9 +971,13 @@ SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<doub
     // pnew = pcpp + 2.0*alpha*q1 + alpha*alpha*(q2-q1);
     // ob_pnew = emObj(pnew,A,QK,cholSigInv,XpsiY,Xpsi,Ns,y,spde);
 
-    //Step 4 stabilization
-    if(std::abs(alpha-1)>0.01){
-      try{ptmp=theta_fixpt(pnew, A, QK, cholSigInv, XpsiY, Xpsi, Ns, y, yy, spde, tol);feval++;}
+    //Step 4 stabilization, unless out of evaluations
+    if(feval>=max_feval){
+      pnew=p2cpp;
+      alpha=1;
+      extrap=false;
+    }else if(std::abs(alpha-1)>0.01){
+      try{ptmp=theta_fixpt(pnew, A, QK, cholSigInv, XpsiY, Ns, yy, n_obs, spde, tol, mixed_precision, Fm);feval++;}
       catch(...){
         pnew=p2cpp;
         if(alpha==stepmax){
@@ -781,6 +987,7 @@ SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<doub
         extrap=false;
         if(alpha==stepmax){stepmax=SquaremDefault.mstep*stepmax;}
         if(stepmin<0 && alpha==stepmin){stepmin=SquaremDefault.mstep*stepmin;}
+        pprev=pcpp;
         pcpp=pnew;
         if(verbose){Rcout<<"Residual: "<<res<<"  Extrapolation: "<<extrap<<"  Steplength: "<<alpha<<std::endl;}
         iter++;
@@ -812,12 +1019,18 @@ SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<doub
     if(alpha==stepmax){stepmax=SquaremDefault.mstep*stepmax;}
     if(stepmin<0 && alpha==stepmin){stepmin=SquaremDefault.mstep*stepmin;}
 
+    pprev=pcpp;
     pcpp=pnew;
     if(verbose){Rcout<<"Residual: "<<res<<"  Extrapolation: "<<extrap<<"  Steplength: "<<alpha<<std::endl;}
     iter++;
   }
 
-  if (feval >= SquaremDefault.maxiter){conv=false;}
+  if (feval >= max_feval){conv=false;}
+
+  //Final state, also checkpointed so that the fit can warm-start a refit
+  state.par=pcpp;state.par_prev=pprev;state.stepmin=stepmin;state.stepmax=stepmax;
+  state.iter=iter;state.feval=feval;
+  if(do_checkpoint){writeEMCheckpoint(checkpoint_file, state, A.rows(), Ns);}
 
   //assigning values
   sqobj.par=pcpp;
@@ -829,25 +1042,198 @@ SquaremOutput theta_squarem2(Eigen::VectorXd par, const Eigen::SparseMatrix<doub
   return(sqobj);
 }
 
+/*
+ The diagonal of Sig_inv^{-1} by selected inversion (the Takahashi equations)
+ from the Cholesky factor P Sig_inv P' = L L'. Z = (L L')^{-1} is computed only
+ on the pattern of L, column by column from the last, using
+   Z_ij = -(1/L_jj) sum_{k > j} L_kj Z_ik              (i > j)
+   Z_jj = 1/L_jj^2 - (1/L_jj) sum_{k > j} L_kj Z_kj
+ where every Z_ik needed is itself on the pattern of L. The cost is of the
+ order of the factorization, and no dense inverse is formed. The result is
+ returned in the original (unpermuted) order.
+ */
+Eigen::VectorXd selInvDiag(const SimplicialLLT<Eigen::SparseMatrix<double> > &chol) {
+  Eigen::SparseMatrix<double> L = chol.matrixL();
+  L.makeCompressed();
+  int n = L.cols();
+  const int *outer = L.outerIndexPtr(), *rows = L.innerIndexPtr();
+  const double *Lx = L.valuePtr();
+  std::vector<double> Zx(L.nonZeros(), 0.);
+  // Position of Z(b, a), b >= a, in the compressed storage of column a.
+  auto zpos = [&](int a, int b) {
+    const int *first = rows + outer[a], *last = rows + outer[a + 1];
+    return (int) (std::lower_bound(first, last, b) - rows);
+  };
+  for (int j = n - 1; j >= 0; j--) {
+    int d = outer[j];
+    if (rows[d] != j) { Rcpp::stop("Unexpected structure in the Cholesky factor."); }
+    double ljj = Lx[d];
+    // Off-diagonal entries, then the diagonal.
+    for (int p = d + 1; p < outer[j + 1]; p++) {
+      int i = rows[p];
+      double sum = 0.;
+      for (int q = d + 1; q < outer[j + 1]; q++) {
+        int k = rows[q];
+        sum += Lx[q] * Zx[zpos(std::min(i, k), std::max(i, k))];
+      }
+      Zx[p] = -sum / ljj;
+    }
+    double sum = 0.;
+    for (int q = d + 1; q < outer[j + 1]; q++) { sum += Lx[q] * Zx[q]; }
+    Zx[d] = 1. / (ljj * ljj) - sum / ljj;
+  }
+  Eigen::VectorXd diagZ(n), out(n);
+  for (int j = 0; j < n; j++) { diagZ(j) = Zx[outer[j]]; }
+  const Eigen::VectorXi &perm = chol.permutationP().indices();
+  for (int i = 0; i < n; i++) { out(i) = diagZ(perm(i)); }
+  return out;
+}
+
+/*
+ n_samples draws from N(mu, Sig_inv^{-1}) using its Cholesky factor:
+ mu + P' L^{-T} z for standard normal z.
+ */
+Eigen::MatrixXd postSamples(const SimplicialLLT<Eigen::SparseMatrix<double> > &chol,
+                            const Eigen::VectorXd &mu, int n_samples) {
+  int n = mu.size();
+  Eigen::MatrixXd Z(n, n_samples);
+  Rcpp::NumericVector x(1);
+  for (int j = 0; j < n_samples; j++) {
+    for (int i = 0; i < n; i++) {
+      x = Rcpp::rnorm(1);
+      Z(i, j) = x(0);
+    }
+  }
+  Eigen::MatrixXd W = chol.matrixU().solve(Z);
+  Eigen::MatrixXd out = chol.permutationPinv() * W;
+  out.colwise() += mu;
+  return out;
+}
+
+typedef Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> PermMat;
+
+/*
+ If spde was reordered by create_listRcpp, its matrices are already in the
+ new vertex order. Set Perm to the permutation of the nKs latent fields that
+ renumbers the vertices within every field and session block in that order,
+ from the inverse order iperm (1-based: vertex v becomes vertex iperm[v]), so
+ that the data-side operators can be permuted to match. Returns false if
+ spde was not reordered.
+ */
+bool spdeOrder(const List &spde, int nKs, PermMat &Perm) {
+  if (!spde.containsElementNamed("reordered") || !Rcpp::as<bool>(spde["reordered"])) {
+    return false;
+  }
+  Rcpp::IntegerVector iperm = spde["iperm"];
+  int nv = iperm.size();
+  if (nv < 1 || nKs % nv != 0) { Rcpp::stop("`A` does not match the SPDE matrices."); }
+  std::vector<bool> seen(nv, false);
+  Perm.resize(nKs);
+  for (int v = 0; v < nv; v++) {
+    int r = iperm[v] - 1;
+    if (r < 0 || r >= nv || seen[r]) { Rcpp::stop("`spde$iperm` is not a permutation."); }
+    seen[r] = true;
+    for (int b = 0; b < nKs / nv; b++) { Perm.indices()(b * nv + v) = b * nv + r; }
+  }
+  return true;
+}
+
 //' Perform the EM algorithm of the Bayesian GLM fitting
 //'
 //' @param theta the vector of initial values for theta
-//' @param spde a list containing the sparse matrix elements Cmat, Gmat, and GtCinvG
+//' @param spde a list containing the sparse matrix elements Cmat, Gmat, and
+//'   GtCinvG, as returned by \code{create_listRcpp}. If it was reordered,
+//'   the fit runs with the mesh vertices in that order, for the memory
+//'   locality of the sparse products: \code{X}, \code{Psi} and \code{A} are
+//'   given in the original vertex order and permuted here, and all outputs
+//'   are returned in the original vertex order.
 //' @param y the vector of response values
 //' @param X the sparse matrix of the data values
-//' @param QK a sparse matrix of the prior precision found using the initial values of the hyperparameters
+//' @param QK a sparse matrix of the prior precision found using the initial
+//'   values of the hyperparameters, from \code{spde} (so in its vertex order)
 //' @param Psi a sparse matrix representation of the basis function mapping the data locations to the mesh vertices
 //' @param A a precomputed matrix crossprod(X%*%Psi)
 //' @param Ns the number of columns for the random matrix used in the Hutchinson estimator
 //' @param tol a value for the tolerance used for a stopping rule (compared to
 //'   the squared norm of the differences between \code{theta(s)} and \code{theta(s-1)})
 //' @param verbose (logical) Should intermediate output be displayed?
+//' @param mixed_precision (logical) Store and multiply the Hutchinson probes
+//'   and their solutions in single precision? The factorization, the trace
+//'   accumulations and the SQUAREM updates remain in double precision.
+//' @param checkpoint_file path of a file to which the state of the EM is
+//'   written every \code{checkpoint_every} iterations, and at the end. Use
+//'   \code{""} (default) not to write checkpoints.
+//' @param checkpoint_every the number of SQUAREM iterations between checkpoints
+//' @param resume path of a checkpoint written by a previous call for the same
+//'   data, from which to resume. The iterates, step lengths, iteration counts
+//'   and random number generator state are restored, so the run continues
+//'   exactly as if it had not been interrupted; \code{theta} is ignored. Use
+//'   \code{""} (default) to start from \code{theta}.
+//' @param warm_start the \code{state} element of a previous result (for
+//'   example, from a fit to fewer sessions or a different mask), or
+//'   \code{NULL} (default). The EM then starts from its estimate of theta and
+//'   its step lengths, with the iteration counts reset; \code{theta} is
+//'   ignored.
+//' @param return_var (logical) Also return the posterior variances, the
+//'   diagonal of the posterior covariance, computed by selected inversion
+//'   from the final Cholesky factor?
+//' @param n_samples the number of draws from the posterior of the latent
+//'   fields to return, using the final Cholesky factor
+//'
+//' @return A list with the estimates of theta and the posterior mean
+//'   \code{mu}, and the final \code{state} of the EM, which can be passed as
+//'   \code{warm_start} to a later call. With \code{return_var}, the posterior
+//'   variances \code{var}, in the same order as \code{mu}; with
+//'   \code{n_samples > 0}, the matrix \code{samples} with one draw per
+//'   column.
 //' 
-// [[Rcpp::export(.findTheta, rng = false)]]
+// [[Rcpp::export(.findTheta)]]
 Rcpp::List findTheta(Eigen::VectorXd theta, List spde, Eigen::VectorXd y,
                      Eigen::SparseMatrix<double> X, Eigen::SparseMatrix<double> QK,
                      Eigen::SparseMatrix<double> Psi, Eigen::SparseMatrix<double> A,
-                     int Ns, double tol, bool verbose = false) {
+                     int Ns, double tol, bool verbose = false,
+                     bool mixed_precision = false,
+                     std::string checkpoint_file = "", int checkpoint_every = 10,
+                     std::string resume = "",
+                     Rcpp::Nullable<Rcpp::List> warm_start = R_NilValue,
+                     bool return_var = false, int n_samples = 0) {
+  // With a reordered spde (and so QK), A and the columns of Psi are permuted
+  // here to match, and the outputs are permuted back before returning.
+  PermMat Perm;
+  bool reorder = spdeOrder(spde, A.rows(), Perm);
+  if (reorder) {
+    A = Perm * A * Perm.transpose();
+    Psi = Psi * Perm.transpose();
+  }
+  // Starting state of the EM: a checkpoint, a previous fit, or theta.
+  SquaremState state;
+  state.par = theta;
+  state.par_prev = theta;
+  state.stepmin = SquaremDefault.stepmin0;
+  state.stepmax = SquaremDefault.stepmax0;
+  if (!resume.empty()) {
+    int nKs_ck, Ns_ck;
+    Rcpp::IntegerVector seed;
+    readEMCheckpoint(resume, state, nKs_ck, Ns_ck, seed);
+    if (state.par.size() != theta.size() || nKs_ck != A.rows() || Ns_ck != Ns) {
+      Rcpp::stop("The EM checkpoint does not match this model.");
+    }
+    if (seed.size() > 0) {
+      Rcpp::Environment::global_env().assign(".Random.seed", seed);
+      GetRNGstate();
+    }
+  } else if (warm_start.isNotNull()) {
+    Rcpp::List ws(warm_start);
+    Eigen::VectorXd ws_theta = Rcpp::as<Eigen::VectorXd>(ws["theta"]);
+    if (ws_theta.size() != theta.size()) {
+      Rcpp::stop("`warm_start` has a different number of parameters than `theta`.");
+    }
+    state.par = ws_theta;
+    state.par_prev = Rcpp::as<Eigen::VectorXd>(ws["theta_prev"]);
+    state.stepmin = Rcpp::as<double>(ws["stepmin"]);
+    state.stepmax = Rcpp::as<double>(ws["stepmax"]);
+  }
+  theta = state.par;
   // Bring in the spde matrices
   Eigen::SparseMatrix<double> Cmat     = Eigen::SparseMatrix<double> (spde["Cmat"]);
   Eigen::SparseMatrix<double> Gmat     = Eigen::SparseMatrix<double> (spde["Gmat"]);
@@ -891,20 +1277,157 @@ Rcpp::List findTheta(Eigen::VectorXd theta, List spde, Eigen::VectorXd y,
   // Using SQUAREM
   SquaremOutput SQ_result;
   SquaremDefault.tol = tol;
-  SQ_result = theta_squarem2(theta, A, QK, cholSigInv, XpsiY, Xpsi, Ns, y, yy, spde, tol, verbose);
+  SQ_result = theta_squarem2(A, QK, cholSigInv, XpsiY, Ns, yy, y.size(), spde, tol, verbose,
+                             mixed_precision, state, checkpoint_file, checkpoint_every);
   theta= SQ_result.par;
   // Bring results together for output
   if(verbose) {Rcout << "Final theta: " << theta.transpose() << std::endl;}
+  // The posterior at the final theta, with the prior precision rebuilt for it:
+  // theta_squarem2 only updates its own copy of QK.
+  updateQK(&QK, theta, spde);
   AdivS2 = A / theta[sig2_ind];
   Sig_inv = QK + AdivS2;
   cholSigInv.factorize(Sig_inv);
   Eigen::VectorXd m = XpsiY / theta(sig2_ind);
   Eigen::VectorXd mu = cholSigInv.solve(m);
+  Eigen::VectorXd var_post;
+  Eigen::MatrixXd samples;
+  if (return_var) { var_post = selInvDiag(cholSigInv); }
+  if (n_samples > 0) { samples = postSamples(cholSigInv, mu, n_samples); }
+  if (reorder) {
+    mu = Perm.transpose() * mu;
+    if (return_var) { var_post = Perm.transpose() * var_post; }
+    if (n_samples > 0) { samples = Perm.transpose() * samples; }
+  }
   List out = List::create(Named("theta_new") = theta,
                           Named("kappa2_new") = theta.segment(0,K),
                           Named("phi_new") = theta.segment(K,K),
                           Named("sigma2_new") = theta(2*K),
-                          Named("mu") = mu);
+                          Named("mu") = mu,
+                          Named("state") = stateToList(state));
+  if (return_var) { out["var"] = var_post; }
+  if (n_samples > 0) { out["samples"] = samples; }
   return out;
 }
 
+
+//' Perform the EM algorithm of the Bayesian GLM fitting from sufficient statistics
+//'
+//' Counterpart to \code{.findTheta} for data that is only available through
+//'   its sufficient statistics, for example accumulated block by block with
+//'   \code{.emStatsUpdateCpp} as the volumes of a session arrive. The EM
+//'   depends on the data only through \code{XpsiY}, \code{A}, \code{yy} and
+//'   the number of observations, so the fit does not depend on the length of
+//'   the session. The number of fixed-point evaluations, each one sparse
+//'   factorization and \code{Ns} solves, is capped at \code{max_evals}, which
+//'   bounds the time taken by each update.
+//'
+//' @param theta the vector of initial values for theta, used if
+//'   \code{warm_start} is \code{NULL}
+//' @param spde a list containing the sparse matrix elements Cmat, Gmat, and
+//'   GtCinvG, as returned by \code{create_listRcpp}. If it was reordered,
+//'   \code{XpsiY} and \code{A} are permuted to match, as in
+//'   \code{.findTheta}.
+//' @param XpsiY the vector \code{crossprod(X%*%Psi, y)}
+//' @param A the matrix \code{crossprod(X%*%Psi)}
+//' @param yy the scalar \code{crossprod(y)}
+//' @param n_obs the number of observations, \code{length(y)}
+//' @param QK a sparse matrix of the prior precision found using the initial
+//'   values of the hyperparameters, from \code{spde} (so in its vertex order)
+//' @param Ns the number of columns for the random matrix used in the Hutchinson estimator
+//' @param tol a value for the tolerance used for a stopping rule (compared to
+//'   the squared norm of the differences between \code{theta(s)} and \code{theta(s-1)})
+//' @param max_evals the maximum number of fixed-point evaluations. Use a
+//'   negative value for the default limit of \code{.findTheta}.
+//' @param warm_start the \code{state} element of a previous result, from
+//'   which to start, or \code{NULL} (default) to start from \code{theta}
+//' @param verbose (logical) Should intermediate output be displayed?
+//' @param mixed_precision (logical) Store and multiply the Hutchinson probes
+//'   and their solutions in single precision?
+//'
+//' @return A list with the estimates of theta and the posterior mean
+//'   \code{mu} as in \code{.findTheta}, the final \code{state} of the EM, and
+//'   \code{converged}, whether the stopping rule was met within
+//'   \code{max_evals} evaluations.
+//'
+// [[Rcpp::export(.findThetaStatsCpp)]]
+Rcpp::List findThetaStatsCpp(Eigen::VectorXd theta, List spde, Eigen::VectorXd XpsiY,
+                             Eigen::SparseMatrix<double> A, double yy, double n_obs,
+                             Eigen::SparseMatrix<double> QK, int Ns, double tol,
+                             int max_evals = -1,
+                             Rcpp::Nullable<Rcpp::List> warm_start = R_NilValue,
+                             bool verbose = false, bool mixed_precision = false) {
+  if (A.rows() != XpsiY.size() || QK.rows() != A.rows()) {
+    Rcpp::stop("`XpsiY`, `A` and `QK` must have the same dimension.");
+  }
+  if (n_obs <= 0) { Rcpp::stop("`n_obs` must be positive."); }
+  PermMat Perm;
+  bool reorder = spdeOrder(spde, A.rows(), Perm);
+  if (reorder) {
+    A = Perm * A * Perm.transpose();
+    XpsiY = Perm * XpsiY;
+  }
+  SquaremState state;
+  state.par = theta;
+  state.par_prev = theta;
+  state.stepmin = SquaremDefault.stepmin0;
+  state.stepmax = SquaremDefault.stepmax0;
+  if (warm_start.isNotNull()) {
+    Rcpp::List ws(warm_start);
+    Eigen::VectorXd ws_theta = Rcpp::as<Eigen::VectorXd>(ws["theta"]);
+    if (ws_theta.size() != theta.size()) {
+      Rcpp::stop("`warm_start` has a different number of parameters than `theta`.");
+    }
+    state.par = ws_theta;
+    state.par_prev = Rcpp::as<Eigen::VectorXd>(ws["theta_prev"]);
+    state.stepmin = Rcpp::as<double>(ws["stepmin"]);
+    state.stepmax = Rcpp::as<double>(ws["stepmax"]);
+  }
+  theta = state.par;
+  int K = (theta.size() - 1) / 2;
+  int sig2_ind = 2*K;
+  Eigen::SparseMatrix<double> Sig_inv = QK + A / theta[sig2_ind];
+  SimplicialLLT<Eigen::SparseMatrix<double> > cholSigInv;
+  cholSigInv.analyzePattern(Sig_inv);
+  if(verbose) {Rcout << "Initial theta: " << theta.transpose() << std::endl;}
+  SquaremDefault.tol = tol;
+  SquaremOutput SQ_result = theta_squarem2(A, QK, cholSigInv, XpsiY, Ns, yy, n_obs, spde, tol,
+                                           verbose, mixed_precision, state, "", 10, max_evals);
+  theta = SQ_result.par;
+  if(verbose) {Rcout << "Final theta: " << theta.transpose() << std::endl;}
+  // The posterior mean at the final theta, with the prior precision rebuilt
+  // for it as in theta_fixpt.
+  updateQK(&QK, theta, spde);
+  Sig_inv = QK + A / theta[sig2_ind];
+  cholSigInv.factorize(Sig_inv);
+  Eigen::VectorXd mu = cholSigInv.solve(XpsiY / theta(sig2_ind));
+  if (reorder) { mu = Perm.transpose() * mu; }
+  return List::create(Named("theta_new") = theta,
+                      Named("kappa2_new") = theta.segment(0,K),
+                      Named("phi_new") = theta.segment(K,K),
+                      Named("sigma2_new") = theta(2*K),
+                      Named("mu") = mu,
+                      Named("state") = stateToList(state),
+                      Named("converged") = (bool) SQ_result.convergence);
+}
+
+//' Read an EM checkpoint
+//'
+//' @param path path of a checkpoint written by \code{.findTheta}
+//'
+//' @return The \code{state} list stored in the checkpoint, as returned by
+//'   \code{.findTheta}, which can be passed as its \code{warm_start}; with
+//'   the dimension \code{nKs} of the latent fields and the number of probes
+//'   \code{Ns} of the model it belongs to.
+//'
+// [[Rcpp::export(.readEMCheckpointCpp, rng = false)]]
+Rcpp::List readEMCheckpointCpp(std::string path) {
+  SquaremState state;
+  int nKs, Ns;
+  Rcpp::IntegerVector seed;
+  readEMCheckpoint(path, state, nKs, Ns, seed);
+  Rcpp::List out = stateToList(state);
+  out["nKs"] = nKs;
+  out["Ns"] = Ns;
+  return out;
+}
@@ -0,0 +1,146 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+typedef Eigen::Map<Eigen::SparseMatrix<double> > SpMap;
+
+//' Cross-products of the design for each subject on a shared pattern
+//'
+//' Assembles, for each subject, the upper triangle of \code{crossprod(Xmat)}
+//'   and \code{crossprod(Xmat, y)}, where \code{Xmat} is the block-diagonal
+//'   matrix of the subject's session design matrices with the columns in
+//'   \code{drop} set to zero. They are formed from the cross-products of
+//'   each session, \code{crossprod(X)} and \code{crossprod(X, y)}, as
+//'   returned by \code{fit_bayesglm}, so the design matrices are never
+//'   needed. The sparsity pattern is formed once, as the union over
+//'   subjects, and each subject contributes only its values on that pattern.
+//'
+//' @param Xcros a list with, for each subject, the list of the cross-products
+//'   of its session design matrices (\code{dgCMatrix}). All subjects must
+//'   have the same number of sessions, and all cross-products the same size.
+//' @param Xycros a list with, for each subject, the list of the
+//'   cross-products of its session design matrices and response vectors
+//' @param drop logical vector with one entry per design column, or of length
+//'   zero to keep all columns
+//' @param n_threads the number of threads to use
+//'
+//' @return A list with the compressed-column pattern \code{p}, \code{i} and
+//'   \code{Dim} of the upper triangle of the cross-products, and the lists
+//'   \code{x} and \code{Xy} with the values of \code{crossprod(Xmat)} on
+//'   that pattern and of \code{crossprod(Xmat, y)} for each subject.
+//'
+// [[Rcpp::export(.crossprodSubjectsCpp, rng = false)]]
+Rcpp::List crossprodSubjectsCpp(const Rcpp::List Xcros, const Rcpp::List Xycros,
+                                const Rcpp::LogicalVector drop, int n_threads = 1) {
+  int nN = Xcros.size();
+  if (nN < 1) { Rcpp::stop("`Xcros` must have at least one subject."); }
+  if (Xycros.size() != nN) { Rcpp::stop("`Xycros` must have one entry per subject."); }
+  n_threads = nThreads(n_threads);
+
+  // Map the cross-products without copying them.
+  int nS = Rcpp::List(Xcros[0]).size(), nC = -1;
+  std::vector<std::vector<SpMap> > XX(nN);
+  std::vector<std::vector<Eigen::Map<Eigen::VectorXd> > > Xy(nN);
+  for (int n = 0; n < nN; n++) {
+    Rcpp::List XX_n(Xcros[n]), Xy_n(Xycros[n]);
+    if (XX_n.size() != nS || Xy_n.size() != nS) {
+      Rcpp::stop("All subjects must have the same number of sessions.");
+    }
+    for (int s = 0; s < nS; s++) {
+      XX[n].push_back(Rcpp::as<SpMap>(XX_n[s]));
+      Xy[n].push_back(Rcpp::as<Eigen::Map<Eigen::VectorXd> >(Xy_n[s]));
+      if (nC < 0) { nC = XX[n][s].cols(); }
+      if (XX[n][s].cols() != nC || XX[n][s].rows() != nC || Xy[n][s].size() != nC) {
+        Rcpp::stop("All cross-products must be square, of the same size.");
+      }
+    }
+  }
+  std::vector<char> dropped(nC, 0);
+  if (drop.size() > 0) {
+    if (drop.size() != nC) { Rcpp::stop("`drop` must have one entry per design column."); }
+    for (int j = 0; j < nC; j++) { dropped[j] = drop[j] == TRUE; }
+  }
+
+  // Symbolic: the union of the upper-triangular patterns over subjects.
+  std::vector<std::vector<std::vector<int> > > rows_sj(nS, std::vector<std::vector<int> >(nC));
+  for (int s = 0; s < nS; s++) {
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+    {
+      std::vector<int> mark(nC, -1);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+      for (int j = 0; j < nC; j++) {
+        if (dropped[j]) { continue; }
+        std::vector<int> &rows = rows_sj[s][j];
+        for (int n = 0; n < nN; n++) {
+          for (SpMap::InnerIterator it(XX[n][s], j); it; ++it) {
+            int i = it.row();
+            if (i > j || dropped[i] || mark[i] == j) { continue; }
+            mark[i] = j;
+            rows.push_back(i);
+          }
+        }
+        std::sort(rows.begin(), rows.end());
+      }
+    }
+  }
+  int nTot = nS * nC;
+  Rcpp::IntegerVector p(nTot + 1);
+  p[0] = 0;
+  for (int s = 0; s < nS; s++) {
+    for (int j = 0; j < nC; j++) { p[s * nC + j + 1] = p[s * nC + j] + rows_sj[s][j].size(); }
+  }
+  Rcpp::IntegerVector i(p[nTot]);
+  for (int s = 0; s < nS; s++) {
+    for (int j = 0; j < nC; j++) {
+      int q = p[s * nC + j];
+      for (int r : rows_sj[s][j]) { i[q++] = s * nC + r; }
+    }
+  }
+
+  // Numeric: each subject's values on the shared pattern, merging the sorted
+  //   rows of its columns into the sorted rows of the pattern. Entries of the
+  //   pattern that a subject does not have are left at zero.
+  Rcpp::List x(nN), Xy_out(nN);
+  const int *pp = p.begin();
+  for (int n = 0; n < nN; n++) {
+    Rcpp::NumericVector x_n(p[nTot]), Xy_n(nTot);
+    double *xv = x_n.begin(), *xyv = Xy_n.begin();
+    for (int s = 0; s < nS; s++) {
+      const SpMap &XX_ns = XX[n][s];
+      const std::vector<std::vector<int> > &rows_j = rows_sj[s];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64) num_threads(n_threads)
+#endif
+      for (int j = 0; j < nC; j++) {
+        int col = s * nC + j;
+        if (dropped[j]) { xyv[col] = 0.; continue; }
+        xyv[col] = Xy[n][s](j);
+        int q = pp[col];
+        const std::vector<int> &rows = rows_j[j];
+        std::size_t h = 0;
+        for (SpMap::InnerIterator it(XX_ns, j); it && it.row() <= j; ++it) {
+          if (dropped[it.row()]) { continue; }
+          while (rows[h] < it.row()) { h++; }
+          xv[q + h] = it.value();
+        }
+      }
+    }
+    x[n] = x_n;
+    Xy_out[n] = Xy_n;
+  }
+
+  return Rcpp::List::create(Named("p") = p,
+                            Named("i") = i,
+                            Named("Dim") = Rcpp::IntegerVector::create(nTot, nTot),
+                            Named("x") = x,
+                            Named("Xy") = Xy_out);
+}
@@ -0,0 +1,130 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <unsupported/Eigen/FFT>
+#include <complex>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ The FFT length used for open convolutions of length n: the smallest integer
+ >= n whose only prime factors are 2, 3 and 5, for which the FFT is fast.
+ */
+int fftLength(int n) {
+  for (int m = std::max(n, 1); ; m++) {
+    int r = m;
+    while (r % 2 == 0) { r /= 2; }
+    while (r % 3 == 0) { r /= 3; }
+    while (r % 5 == 0) { r /= 5; }
+    if (r == 1) { return m; }
+  }
+}
+
+//' Convolve stimulus functions with HRF bases
+//'
+//' Batched counterpart to \code{convolve(stim[,s], rev(HRF[,h]), type="open")}
+//'   for a set of (stimulus, HRF) pairs, followed by downsampling to
+//'   \code{inds}. A single FFT length is chosen for all pairs, each stimulus
+//'   and each HRF basis is transformed once, and each pair then only needs a
+//'   product and one inverse transform. Pairs are processed in parallel.
+//'
+//' @param stim the \eqn{L \times J} matrix of upsampled stimulus functions
+//' @param HRF the \eqn{M \times H} matrix of upsampled HRF bases
+//' @param pairs the \eqn{P \times 2} matrix of (1-based) stimulus and HRF
+//'   columns to convolve
+//' @param inds the (1-based) indices of the convolution to keep
+//' @param stim_one optional \eqn{L \times J} matrix of one-event stimulus
+//'   functions. If provided, each convolution is divided by the maximum of the
+//'   convolution of the one-event stimulus with the same HRF basis, before
+//'   downsampling.
+//' @param n_threads the number of threads to use
+//'
+//' @return The \eqn{length(inds) \times P} matrix of downsampled convolutions.
+//'
+// [[Rcpp::export(.convolveHRFCpp, rng = false)]]
+Eigen::MatrixXd convolveHRFCpp(const Eigen::Map<Eigen::MatrixXd> stim,
+                               const Eigen::Map<Eigen::MatrixXd> HRF,
+                               const Rcpp::IntegerMatrix pairs,
+                               const Rcpp::IntegerVector inds,
+                               Rcpp::Nullable<Rcpp::NumericMatrix> stim_one = R_NilValue,
+                               int n_threads = 1) {
+  typedef std::complex<double> Cplx;
+  typedef Eigen::Matrix<Cplx, Eigen::Dynamic, 1> VectorXcd;
+  int L = stim.rows(), J = stim.cols(), M = HRF.rows(), H = HRF.cols();
+  int P = pairs.nrow(), nI = inds.size();
+  int n_open = L + M - 1;
+  if (pairs.ncol() != 2) { Rcpp::stop("`pairs` must have two columns."); }
+  for (int p = 0; p < P; p++) {
+    if (pairs(p, 0) < 1 || pairs(p, 0) > J || pairs(p, 1) < 1 || pairs(p, 1) > H) {
+      Rcpp::stop("`pairs` is out of bounds.");
+    }
+  }
+  for (int t = 0; t < nI; t++) {
+    if (inds[t] < 1 || inds[t] > n_open) { Rcpp::stop("`inds` is out of bounds."); }
+  }
+  bool do_norm = stim_one.isNotNull();
+  Eigen::MatrixXd one;
+  if (do_norm) {
+    one = Rcpp::as<Eigen::MatrixXd>(stim_one.get());
+    if (one.rows() != L || one.cols() != J) {
+      Rcpp::stop("`stim_one` must have the same dimensions as `stim`.");
+    }
+  }
+  n_threads = nThreads(n_threads);
+  int nfft = fftLength(n_open);
+
+  // Transform each stimulus and HRF basis once, zero-padded to nfft.
+  std::vector<VectorXcd> F_stim(J), F_one(do_norm ? J : 0), F_HRF(H);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+  {
+    Eigen::FFT<double> fft;
+    Eigen::VectorXd pad(nfft);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (int q = 0; q < J + H + (do_norm ? J : 0); q++) {
+      pad.setZero();
+      if (q < J) {
+        pad.head(L) = stim.col(q);
+        fft.fwd(F_stim[q], pad);
+      } else if (q < J + H) {
+        pad.head(M) = HRF.col(q - J);
+        fft.fwd(F_HRF[q - J], pad);
+      } else {
+        pad.head(L) = one.col(q - J - H);
+        fft.fwd(F_one[q - J - H], pad);
+      }
+    }
+  }
+
+  // Multiply, invert, normalize and downsample each pair.
+  Eigen::MatrixXd out(nI, P);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+  {
+    Eigen::FFT<double> fft;
+    Eigen::VectorXd conv(nfft);
+    VectorXcd prod(nfft);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (int p = 0; p < P; p++) {
+      int s = pairs(p, 0) - 1, h = pairs(p, 1) - 1;
+      double scale = 1.;
+      if (do_norm) {
+        prod = F_one[s].cwiseProduct(F_HRF[h]);
+        fft.inv(conv, prod);
+        scale = 1. / conv.head(n_open).maxCoeff();
+      }
+      prod = F_stim[s].cwiseProduct(F_HRF[h]);
+      fft.inv(conv, prod);
+      for (int t = 0; t < nI; t++) { out(t, p) = conv(inds[t] - 1) * scale; }
+    }
+  }
+  return out;
+}
@@ -0,0 +1,212 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+
+using namespace Rcpp;
+using namespace Eigen;
+
+//' Vertex adjacency of a triangular mesh
+//'
+//' Builds the sparse \eqn{V \times V} adjacency matrix of the mesh, in which
+//'   two vertices are adjacent if they share a face. Each face contributes its
+//'   three edges once, and duplicates are merged when the compressed matrix is
+//'   formed. The matrix is symmetric, so its compressed columns double as the
+//'   neighbor lists of each vertex.
+//'
+//' @param faces the \eqn{F \times 3} matrix of (1-based) vertex indices
+//' @param n_vertex the number of vertices in the mesh
+//'
+// [[Rcpp::export(.meshAdjacencyCpp, rng = false)]]
+Eigen::SparseMatrix<double> meshAdjacencyCpp(const Rcpp::IntegerMatrix faces, int n_vertex) {
+  int nF = faces.nrow();
+  if (faces.ncol() != 3) { Rcpp::stop("`faces` must have three columns."); }
+  std::vector<Eigen::Triplet<double> > trips;
+  trips.reserve((std::size_t) nF * 6);
+  for (int f = 0; f < nF; f++) {
+    for (int q = 0; q < 3; q++) {
+      int i = faces(f, q) - 1, j = faces(f, (q + 1) % 3) - 1;
+      if (i < 0 || i >= n_vertex || j < 0 || j >= n_vertex) {
+        Rcpp::stop("`faces` is out of bounds.");
+      }
+      if (i == j) { continue; }
+      trips.push_back(Eigen::Triplet<double>(i, j, 1.));
+      trips.push_back(Eigen::Triplet<double>(j, i, 1.));
+    }
+  }
+  Eigen::SparseMatrix<double> adj(n_vertex, n_vertex);
+  adj.setFromTriplets(trips.begin(), trips.end(),
+                      [] (const double &, const double &) { return 1.; });
+  return adj;
+}
+
+//' Boundary layers around a vertex mask
+//'
+//' Computes, for every vertex, the number of edges to the closest in-mask
+//'   vertex, up to \code{boundary_width}, with a single breadth-first search
+//'   started from all in-mask vertices at once. In-mask vertices with a
+//'   neighbor outside the mask are set to \code{0}, and all other vertices
+//'   (the mask interior, and vertices further than \code{boundary_width}) are
+//'   set to \code{-1}.
+//'
+//' @param adj the sparse \eqn{V \times V} vertex adjacency matrix
+//' @param mask logical vector of length \eqn{V}
+//' @param boundary_width the number of layers to compute
+//'
+// [[Rcpp::export(.boundaryLayersCpp, rng = false)]]
+Rcpp::NumericVector boundaryLayersCpp(const Eigen::Map<Eigen::SparseMatrix<double> > adj,
+                                      const Rcpp::LogicalVector mask,
+                                      int boundary_width) {
+  int nV = adj.cols();
+  if (adj.rows() != nV) { Rcpp::stop("`adj` must be square."); }
+  if (mask.size() < nV) { Rcpp::stop("`mask` must have one entry per vertex."); }
+  typedef Eigen::Map<Eigen::SparseMatrix<double> >::InnerIterator NbIt;
+
+  std::vector<char> in_mask(nV);
+  for (int v = 0; v < nV; v++) { in_mask[v] = mask[v] == TRUE; }
+
+  // Layer 0: in-mask vertices with a neighbor outside the mask.
+  Rcpp::NumericVector layer(nV, -1.);
+  std::vector<char> seen(nV, 0);
+  std::vector<int> frontier, next;
+  for (int v = 0; v < nV; v++) {
+    if (!in_mask[v]) { continue; }
+    seen[v] = 1;
+    for (NbIt it(adj, v); it; ++it) {
+      if (!in_mask[it.row()]) {
+        layer[v] = 0;
+        frontier.push_back(v);
+        break;
+      }
+    }
+  }
+
+  // Layer d: unseen neighbors of layer d-1.
+  for (int d = 1; d <= boundary_width && !frontier.empty(); d++) {
+    next.clear();
+    for (int v : frontier) {
+      for (NbIt it(adj, v); it; ++it) {
+        int u = it.row();
+        if (seen[u]) { continue; }
+        seen[u] = 1;
+        layer[u] = d;
+        next.push_back(u);
+      }
+    }
+    frontier.swap(next);
+  }
+  return layer;
+}
+
+/*
+ Reverse Cuthill-McKee ordering of the n x n symmetric sparsity pattern in
+ compressed-column form (p, i). Each connected component is numbered by a
+ breadth-first search from a pseudo-peripheral vertex, found by repeated
+ searches from a vertex of minimum degree, visiting neighbors in order of
+ increasing degree; the whole ordering is then reversed. Returns order, with
+ order[new] = old, so that vertices that are close on the mesh get nearby
+ indices.
+ */
+std::vector<int> rcmOrder(int n, const int *p, const int *i) {
+  std::vector<int> degree(n);
+  for (int v = 0; v < n; v++) {
+    degree[v] = 0;
+    for (int q = p[v]; q < p[v + 1]; q++) { if (i[q] != v) { degree[v]++; } }
+  }
+
+  // Breadth-first search from root over unnumbered vertices: the vertices in
+  // order of visit, and the index at which the last level starts. Returns the
+  // number of levels after the root.
+  std::vector<int> level_of(n, -1);
+  std::vector<char> numbered(n, 0);
+  auto bfs = [&](int root, std::vector<int> &visit, int &last_start) {
+    visit.clear();
+    visit.push_back(root);
+    level_of[root] = 0;
+    last_start = 0;
+    for (std::size_t h = 0; h < visit.size(); h++) {
+      int v = visit[h];
+      if (level_of[v] > level_of[visit[last_start]]) { last_start = h; }
+      for (int q = p[v]; q < p[v + 1]; q++) {
+        int u = i[q];
+        if (u == v || numbered[u] || level_of[u] >= 0) { continue; }
+        level_of[u] = level_of[v] + 1;
+        visit.push_back(u);
+      }
+    }
+    int depth = level_of[visit.back()];
+    for (int v : visit) { level_of[v] = -1; }
+    return depth;
+  };
+
+  std::vector<int> order, visit, visit_cand, nbrs;
+  order.reserve(n);
+  std::vector<int> by_degree(n);
+  for (int v = 0; v < n; v++) { by_degree[v] = v; }
+  std::stable_sort(by_degree.begin(), by_degree.end(),
+                   [&](int a, int b) { return degree[a] < degree[b]; });
+
+  for (int start : by_degree) {
+    if (numbered[start]) { continue; }
+    // Pseudo-peripheral root: move to a minimum-degree vertex of the last
+    // level while that increases the number of levels.
+    int root = start, last_start, last_cand;
+    int depth = bfs(root, visit, last_start);
+    while (true) {
+      int cand = visit[last_start];
+      for (std::size_t h = last_start; h < visit.size(); h++) {
+        if (degree[visit[h]] < degree[cand]) { cand = visit[h]; }
+      }
+      int depth_cand = bfs(cand, visit_cand, last_cand);
+      if (depth_cand <= depth) { break; }
+      root = cand;
+      depth = depth_cand;
+      last_start = last_cand;
+      visit.swap(visit_cand);
+    }
+
+    // Cuthill-McKee numbering of the component from root.
+    std::size_t first = order.size();
+    order.push_back(root);
+    numbered[root] = 1;
+    for (std::size_t h = first; h < order.size(); h++) {
+      int v = order[h];
+      nbrs.clear();
+      for (int q = p[v]; q < p[v + 1]; q++) {
+        int u = i[q];
+        if (u != v && !numbered[u]) { numbered[u] = 1; nbrs.push_back(u); }
+      }
+      std::stable_sort(nbrs.begin(), nbrs.end(),
+                       [&](int a, int b) { return degree[a] < degree[b]; });
+      order.insert(order.end(), nbrs.begin(), nbrs.end());
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+//' Reverse Cuthill-McKee ordering of a mesh
+//'
+//' Computes a bandwidth-reducing permutation of the vertices from the
+//'   sparsity pattern of a symmetric matrix on the mesh, such as its
+//'   adjacency matrix or the SPDE matrices. Renumbering the vertices in this
+//'   order keeps neighboring vertices close in memory, so sparse products with
+//'   the SPDE matrices have better locality. It is not a fill-reducing
+//'   ordering: sparse Cholesky factorizations apply their own.
+//'
+//' @param adj a symmetric sparse \eqn{V \times V} matrix; only its pattern is
+//'   used
+//'
+//' @return The (1-based) permutation: the \eqn{i}-th vertex in the new order
+//'   is vertex \code{perm[i]} in the original order.
+//'
+// [[Rcpp::export(.rcmOrderCpp, rng = false)]]
+Rcpp::IntegerVector rcmOrderCpp(const Eigen::Map<Eigen::SparseMatrix<double> > adj) {
+  int nV = adj.cols();
+  if (adj.rows() != nV) { Rcpp::stop("`adj` must be square."); }
+  if (!adj.isCompressed()) { Rcpp::stop("`adj` must be compressed."); }
+  std::vector<int> order = rcmOrder(nV, adj.outerIndexPtr(), adj.innerIndexPtr());
+  Rcpp::IntegerVector perm(nV);
+  for (int v = 0; v < nV; v++) { perm[v] = order[v] + 1; }
+  return perm;
+}
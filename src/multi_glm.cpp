@@ -0,0 +1,145 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+#include <cmath>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ RSS of the model [Xk, N] for every column of y, without forming residuals.
+ yr is y residualized on N, with column sums of squares yy, and Q is an
+ orthonormal basis of the columns of N. With Xr = Xk - QQ'Xk, the part of Xk
+ not explained by N, and Xr'Xr = LL', RSS = yr'yr - ||L^{-1} Xr'yr||^2. Both
+ terms are on the scale of the residuals, not of the raw data (whose means
+ are removed with the intercept in N), so the subtraction keeps its digits.
+ Returns false (and leaves RSS untouched) if Xr'Xr is not positive definite.
+ */
+bool modelRSS(const Eigen::Ref<const Eigen::MatrixXd> &Xk,
+              const Eigen::MatrixXd &yr, const Eigen::MatrixXd &Q,
+              const Eigen::VectorXd &yy, Eigen::VectorXd &RSS) {
+  Eigen::MatrixXd Xr = Xk;
+  if (Q.cols() > 0) { Xr.noalias() -= Q * (Q.transpose() * Xk); }
+  Eigen::LLT<Eigen::MatrixXd> llt(Xr.transpose() * Xr);
+  if (llt.info() != Eigen::Success) { return false; }
+  Eigen::MatrixXd W = Xr.transpose() * yr;
+  llt.matrixL().solveInPlace(W);
+  RSS = (yy - W.colwise().squaredNorm().transpose()).cwiseMax(0.);
+  return true;
+}
+
+//' Compare multiple GLMs by their residual sums of squares
+//'
+//' Fits the model \code{[X[,,p], N]} to every column of \code{y} for each
+//'   candidate design \code{p}, from \code{y} residualized once on the shared
+//'   nuisance matrix \code{N}. Models are compared with a relative
+//'   tolerance on their residual SDs. If \code{Xc} has columns, the
+//'   canonical model \code{[Xc, N]} is compared against the null model
+//'   \code{N} with an F-test.
+//'
+//' @param y the \eqn{T \times V} data matrix
+//' @param X the \eqn{T \times K \times P} array of candidate task designs
+//' @param N the \eqn{T \times Q} nuisance matrix, including the intercept
+//' @param Xc the \eqn{T \times K} canonical design matrix, or a matrix with
+//'   zero columns to skip the F-test
+//' @param n_threads the number of threads to use
+//'
+// [[Rcpp::export(.multiGLMCpp, rng = false)]]
+Rcpp::List multiGLMCpp(const Eigen::Map<Eigen::MatrixXd> y,
+                       const Rcpp::NumericVector X,
+                       const Eigen::Map<Eigen::MatrixXd> N,
+                       const Eigen::Map<Eigen::MatrixXd> Xc,
+                       int n_threads = 1) {
+  int nT = y.rows();
+  int nV = y.cols();
+  int nQ = N.cols();
+  Rcpp::IntegerVector dims = X.attr("dim");
+  if (dims.size() != 3 || dims[0] != nT) {
+    Rcpp::stop("`X` must be a T x K x P array matching the rows of `y`.");
+  }
+  int nK = dims[1];
+  int nP = dims[2];
+  n_threads = nThreads(n_threads);
+  EigenThreads eigen_threads(n_threads);
+
+  // Residualize y on the shared nuisance columns once. If N is rank
+  //   deficient, every model is unstable.
+  Eigen::MatrixXd NtN = N.transpose() * N;
+  Eigen::LLT<Eigen::MatrixXd> lltN(NtN);
+  bool unstable_null = lltN.info() != Eigen::Success;
+  Eigen::MatrixXd Q(nT, nQ);
+  if (nQ > 0) {
+    Eigen::HouseholderQR<Eigen::MatrixXd> qrN(N);
+    Q = qrN.householderQ() * Eigen::MatrixXd::Identity(nT, nQ);
+  }
+  Eigen::MatrixXd yr = y;
+  if (nQ > 0 && !unstable_null) { yr.noalias() -= Q * (Q.transpose() * y); }
+  Eigen::VectorXd yy = yr.colwise().squaredNorm().transpose();
+
+  // Residual SD for each location and candidate model.
+  Eigen::MatrixXd RSS(nV, nP);
+  std::vector<int> unstable(nP, 0);
+  const double *Xp = X.begin();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads)
+#endif
+  for (int pp = 0; pp < nP; pp++) {
+    Eigen::Map<const Eigen::MatrixXd> Xk(Xp + (std::ptrdiff_t) pp * nT * nK, nT, nK);
+    Eigen::VectorXd RSS_pp(nV);
+    if (!unstable_null && modelRSS(Xk, yr, Q, yy, RSS_pp)) {
+      RSS.col(pp) = (RSS_pp / (double) (nT - nK - nQ)).cwiseSqrt();
+    } else {
+      unstable[pp] = 1;
+      RSS.col(pp).setConstant(NA_REAL);
+    }
+  }
+
+  // Best model: the minimum residual SD, or NA if all models are equivalent,
+  //   up to rounding.
+  const double rel_tol = 1e-8;
+  Rcpp::IntegerVector bestmodel(nV);
+  for (int v = 0; v < nV; v++) {
+    int wm = -1, n_ok = 0;
+    bool all_equal = true;
+    double first = 0.;
+    for (int pp = 0; pp < nP; pp++) {
+      double r = RSS(v, pp);
+      if (std::isnan(r)) { continue; }
+      if (n_ok == 0) {
+        first = r;
+      } else if (std::abs(r - first) > rel_tol * std::max(std::abs(r), std::abs(first))) {
+        all_equal = false;
+      }
+      if (wm < 0 || r < RSS(v, wm)) { wm = pp; }
+      n_ok++;
+    }
+    bestmodel[v] = (n_ok < 2 || all_equal) ? NA_INTEGER : wm + 1;
+  }
+
+  // F-test of the canonical model against the null model.
+  Eigen::VectorXd Fstat = Eigen::VectorXd::Zero(nV);
+  bool unstable_canonical = false;
+  int DOF1 = nT - Xc.cols() - nQ;
+  if (Xc.cols() > 0) {
+    Eigen::VectorXd RSS1(nV);
+    unstable_canonical = unstable_null || !modelRSS(Xc, yr, Q, yy, RSS1);
+    if (!unstable_canonical && !unstable_null) {
+      // The RSS of the null model is that of y residualized on N.
+      Fstat = (yy - RSS1).cwiseQuotient(RSS1) * ((double) DOF1 / nK);
+    } else {
+      Fstat.setConstant(NA_REAL);
+    }
+  }
+
+  Rcpp::LogicalVector unstable_out(nP);
+  for (int pp = 0; pp < nP; pp++) { unstable_out[pp] = unstable[pp]; }
+  return Rcpp::List::create(Named("RSS") = RSS,
+                            Named("bestmodel") = bestmodel,
+                            Named("Fstat") = Fstat,
+                            Named("DOF1") = DOF1,
+                            Named("unstable") = unstable_out,
+                            Named("unstable_canonical") = unstable_canonical,
+                            Named("unstable_null") = unstable_null);
+}
@@ -0,0 +1,129 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ Whether the factorization of a K x K Gram matrix is of full rank: its pivots
+ must all exceed K * eps times the largest one, close to the reciprocal
+ condition number at which solve() fails in R.
+ */
+bool ldltFullRank(const Eigen::LDLT<Eigen::MatrixXd> &ldlt) {
+  if (ldlt.info() != Eigen::Success) { return false; }
+  Eigen::VectorXd d = ldlt.vectorD().cwiseAbs();
+  if (d.size() == 0) { return true; }
+  double tol = d.size() * std::numeric_limits<double>::epsilon() * d.maxCoeff();
+  return std::isfinite(d.maxCoeff()) && d.minCoeff() > tol;
+}
+
+/*
+ Residualize every column of Y against the shared design X with a single
+ projection: R = Y - X (X'X)^{-1} X'Y. Both cross-products are GEMMs.
+ */
+Eigen::MatrixXd nuisRegShared(const Eigen::Map<Eigen::MatrixXd> &Y,
+                              const Eigen::Map<const Eigen::MatrixXd> &X) {
+  int nK = X.cols();
+  Eigen::MatrixXd XtX = Eigen::MatrixXd::Zero(nK, nK);
+  XtX.selfadjointView<Eigen::Lower>().rankUpdate(X.transpose());
+  Eigen::LDLT<Eigen::MatrixXd> ldlt(XtX);
+  if (!ldltFullRank(ldlt)) {
+    Rcpp::stop("The design is rank deficient: some of its columns are collinear or zero.");
+  }
+  Eigen::MatrixXd B = ldlt.solve(X.transpose() * Y);
+  Eigen::MatrixXd R = Y;
+  R.noalias() -= X * B;
+  return R;
+}
+
+/*
+ Residualize column v of Y against its own T x K design, stored contiguously
+ at X + v*T*K (column-major T x K x V array). Each thread keeps its own K x K
+ Gram, K-vector and factorization, so the loop body does not allocate. Stops
+ if the design of a location is rank deficient, reporting the first such
+ location, numbered from first + 1.
+ */
+Eigen::MatrixXd nuisRegPerLoc(const Eigen::Map<Eigen::MatrixXd> &Y,
+                              const double *X, int nK, int n_threads, int first) {
+  int nT = Y.rows();
+  int nV = Y.cols();
+  Eigen::MatrixXd R(nT, nV);
+  int bad = nV;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+  {
+    Eigen::MatrixXd XtX(nK, nK);
+    Eigen::VectorXd Xty(nK), b(nK);
+    Eigen::LDLT<Eigen::MatrixXd> ldlt(nK);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int v = 0; v < nV; v++) {
+      Eigen::Map<const Eigen::MatrixXd> Xv(X + (std::ptrdiff_t) v * nT * nK, nT, nK);
+      XtX.setZero();
+      XtX.selfadjointView<Eigen::Lower>().rankUpdate(Xv.transpose());
+      Xty.noalias() = Xv.transpose() * Y.col(v);
+      ldlt.compute(XtX);
+      if (!ldltFullRank(ldlt)) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        bad = std::min(bad, v);
+        continue;
+      }
+      b = ldlt.solve(Xty);
+      R.col(v) = Y.col(v);
+      R.col(v).noalias() -= Xv * b;
+    }
+  }
+  if (bad < nV) {
+    Rcpp::stop("The design of location %d is rank deficient: some of its columns are collinear or zero.",
+               first + bad + 1);
+  }
+  return R;
+}
+
+//' Nuisance regression for a shared or per-location design
+//'
+//' Regress the design out of each column of \code{BOLD}. A \eqn{T \times K}
+//'   design is shared by all locations and handled with a single projection.
+//'   A \eqn{T \times K \times V} design has a separate least-squares problem
+//'   for each location, and these are solved in parallel. A rank-deficient
+//'   design, such as collinear regressors or an all-zero column, is an error.
+//'
+//' @param BOLD the \eqn{T \times V} data matrix
+//' @param design the \eqn{T \times K} design matrix, or the
+//'   \eqn{T \times K \times V} array of per-location design matrices
+//' @param n_threads the number of threads to use
+//'
+// [[Rcpp::export(.nuisanceRegressionCpp, rng = false)]]
+Eigen::MatrixXd nuisanceRegressionCpp(const Eigen::Map<Eigen::MatrixXd> BOLD,
+                                      const Rcpp::NumericVector design,
+                                      int n_threads = 1) {
+  int nT = BOLD.rows();
+  int nV = BOLD.cols();
+  n_threads = nThreads(n_threads);
+  Rcpp::IntegerVector dims = design.attr("dim");
+  if (dims.size() < 2 || dims.size() > 3) {
+    Rcpp::stop("`design` must be a matrix or a three-dimensional array.");
+  }
+  if (dims[0] != nT) {
+    Rcpp::stop("`BOLD` and `design` must have the same number of rows.");
+  }
+  int nK = dims[1];
+  if (dims.size() == 2) {
+    EigenThreads eigen_threads(n_threads);
+    Eigen::Map<const Eigen::MatrixXd> X(design.begin(), nT, nK);
+    return nuisRegShared(BOLD, X);
+  }
+  if (dims[2] != nV) {
+    Rcpp::stop("The third dimension of `design` must match the number of columns of `BOLD`.");
+  }
+  return nuisRegPerLoc(BOLD, design.begin(), nK, n_threads, 0);
+}
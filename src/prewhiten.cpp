@@ -1,27 +1,30 @@
 #define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
 #include <Rcpp.h>
 #include <RcppEigen.h>
+#include "threads.h"
 
 using namespace Rcpp;
 using namespace Eigen;
 using namespace std;
 
-//' Get the prewhitening matrix for a single data location
-//'
-//' @param AR_coefs a length-p vector where p is the AR order
-//' @param nTime (integer) the length of the time series that is being prewhitened
-//' @param avg_var a scalar value of the residual variances of the AR model
-//' 
-// [[Rcpp::export(.getSqrtInvCpp)]]
-Eigen::SparseMatrix<double> getSqrtInvCpp(Eigen::VectorXd AR_coefs, int nTime, double avg_var) {
-  double sqrt_var = sqrt(avg_var);
+/*
+ The banded prewhitening matrix for one location, in precision Scalar. The
+ float64 instance is .getSqrtInvCpp; the float32 instance is used by the
+ mixed-precision mode of .getSqrtInvAllCpp.
+ */
+template <typename Scalar>
+Eigen::SparseMatrix<Scalar> sqrtInvBand(const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> &AR_coefs,
+                                        int nTime, Scalar avg_var) {
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Mat;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vec;
+  Scalar sqrt_var = sqrt(avg_var);
   int p = AR_coefs.size();
-  double sqrt_prec = 1/sqrt_var;
-  Eigen::VectorXd Dinv_v(nTime);
+  Scalar sqrt_prec = 1/sqrt_var;
+  Vec Dinv_v(nTime);
   for(int i=0; i<nTime;i++){Dinv_v(i) = sqrt_prec;}
-  Eigen::MatrixXd matDinv_v = Dinv_v.asDiagonal();
-  Eigen::MatrixXd halfInv_v(nTime,nTime);
-  halfInv_v = MatrixXd::Zero(nTime,nTime);
+  Mat matDinv_v = Dinv_v.asDiagonal();
+  Mat halfInv_v(nTime,nTime);
+  halfInv_v = Mat::Zero(nTime,nTime);
   halfInv_v.diagonal().setConstant(1);
   for(int j=0;j<nTime;j++){
     for(int k=1;k<=p;k++) {
@@ -29,20 +32,20 @@ Eigen::SparseMatrix<double> getSqrtInvCpp(Eigen::VectorXd AR_coefs, int nTime, d
       halfInv_v(j+k,j) = -1 * AR_coefs(k-1);
     }
   }
-  Eigen::MatrixXd Inv_v = halfInv_v * halfInv_v.transpose();
-  Eigen::MatrixXd final_Inv_v = matDinv_v * Inv_v * matDinv_v;
-  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> ei(final_Inv_v);
-  Eigen::VectorXd d2inv = ei.eigenvalues().real();
-  Eigen::MatrixXd eVec = ei.eigenvectors().real();
-  Eigen::MatrixXd eDinv_v(nTime,nTime);
-  eDinv_v = MatrixXd::Zero(nTime,nTime);
+  Mat Inv_v = halfInv_v * halfInv_v.transpose();
+  Mat final_Inv_v = matDinv_v * Inv_v * matDinv_v;
+  Eigen::SelfAdjointEigenSolver<Mat> ei(final_Inv_v);
+  Vec d2inv = ei.eigenvalues().real();
+  Mat eVec = ei.eigenvectors().real();
+  Mat eDinv_v(nTime,nTime);
+  eDinv_v = Mat::Zero(nTime,nTime);
   for(int i=0;i<nTime;i++){
     eDinv_v(i,i) = sqrt(d2inv.reverse()(i));
   }
-  Eigen::MatrixXd revEvec = eVec.rowwise().reverse();
-  Eigen::MatrixXd sqrtInv = revEvec * eDinv_v * revEvec.transpose();
-  Eigen::MatrixXd out(nTime,nTime);
-  out = Eigen::MatrixXd::Zero(nTime,nTime);
+  Mat revEvec = eVec.rowwise().reverse();
+  Mat sqrtInv = revEvec * eDinv_v * revEvec.transpose();
+  Mat out(nTime,nTime);
+  out = Mat::Zero(nTime,nTime);
   for(int j=0; j<nTime;j++){
     for(int k=-1*(p+1);k<=p+1;k++) {
       if(j + k < 0){continue;}
@@ -50,6 +53,74 @@ Eigen::SparseMatrix<double> getSqrtInvCpp(Eigen::VectorXd AR_coefs, int nTime, d
       out(j+k,j) = sqrtInv(j+k,j);
     }
   }
-  Eigen::SparseMatrix<double> final_out = out.sparseView(1e-8,1);
+  Eigen::SparseMatrix<Scalar> final_out = out.sparseView(1e-8,1);
   return final_out;
 }
+
+// The float32 instance is also used by the streaming kernel in bold_stream.cpp.
+template Eigen::SparseMatrix<float> sqrtInvBand<float>(const Eigen::VectorXf &AR_coefs,
+                                                       int nTime, float avg_var);
+
+//' Get the prewhitening matrix for a single data location
+//'
+//' @param AR_coefs a length-p vector where p is the AR order
+//' @param nTime (integer) the length of the time series that is being prewhitened
+//' @param avg_var a scalar value of the residual variances of the AR model
+//' 
+// [[Rcpp::export(.getSqrtInvCpp)]]
+Eigen::SparseMatrix<double> getSqrtInvCpp(Eigen::VectorXd AR_coefs, int nTime, double avg_var) {
+  return sqrtInvBand<double>(AR_coefs, nTime, avg_var);
+}
+
+//' Get the block-diagonal prewhitening matrix for all data locations
+//'
+//' Computes the prewhitening matrix of each location, as in
+//'   \code{.getSqrtInvCpp}, in parallel, and assembles them into the
+//'   \eqn{TV \times TV} block-diagonal matrix in location order.
+//'
+//' @param AR_coefs a \eqn{V \times p} matrix of AR coefficients
+//' @param nTime (integer) the length of the time series that is being prewhitened
+//' @param avg_var a length-\eqn{V} vector of the residual variances of the AR models
+//' @param n_threads the number of threads to use
+//' @param mixed_precision (logical) Compute each block in single precision?
+//'   The eigendecomposition of each \eqn{T \times T} block then takes about
+//'   half the memory traffic; the assembled matrix is still double precision.
+//'
+// [[Rcpp::export(.getSqrtInvAllCpp, rng = false)]]
+Eigen::SparseMatrix<double> getSqrtInvAllCpp(const Eigen::Map<Eigen::MatrixXd> AR_coefs,
+                                             int nTime, const Eigen::Map<Eigen::VectorXd> avg_var,
+                                             int n_threads = 1, bool mixed_precision = false) {
+  int nV = AR_coefs.rows();
+  if (avg_var.size() != nV) {
+    Rcpp::stop("`avg_var` must have one entry per row of `AR_coefs`.");
+  }
+  n_threads = nThreads(n_threads);
+  std::vector<Eigen::SparseMatrix<double> > blocks(nV);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads)
+#endif
+  for (int v = 0; v < nV; v++) {
+    if (mixed_precision) {
+      Eigen::VectorXf AR_v = AR_coefs.row(v).transpose().cast<float>();
+      blocks[v] = sqrtInvBand<float>(AR_v, nTime, (float) avg_var(v)).cast<double>();
+    } else {
+      blocks[v] = getSqrtInvCpp(AR_coefs.row(v).transpose(), nTime, avg_var(v));
+    }
+  }
+
+  std::size_t nnz = 0;
+  for (int v = 0; v < nV; v++) { nnz += blocks[v].nonZeros(); }
+  std::vector<Eigen::Triplet<double> > trips;
+  trips.reserve(nnz);
+  for (int v = 0; v < nV; v++) {
+    std::ptrdiff_t offset = (std::ptrdiff_t) v * nTime;
+    for (int j = 0; j < blocks[v].outerSize(); j++) {
+      for (Eigen::SparseMatrix<double>::InnerIterator it(blocks[v], j); it; ++it) {
+        trips.push_back(Eigen::Triplet<double>(offset + it.row(), offset + j, it.value()));
+      }
+    }
+  }
+  Eigen::SparseMatrix<double> sqrtInv_all((std::ptrdiff_t) nTime * nV, (std::ptrdiff_t) nTime * nV);
+  sqrtInv_all.setFromTriplets(trips.begin(), trips.end());
+  return sqrtInv_all;
+}
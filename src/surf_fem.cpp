@@ -0,0 +1,266 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <algorithm>
+#include <utility>
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ The triangles of a surface mesh, and the faces incident to each vertex in
+ compressed form: the faces of vertex v are vf[vp[v]], ..., vf[vp[v+1]-1], in
+ increasing order. tri holds the 0-based vertex indices, three per face.
+ */
+struct SurfMesh {
+  int nV, nF;
+  std::vector<int> tri, vp, vf;
+};
+
+/*
+ Check the (1-based) faces against the number of vertices, and build the
+ vertex-face incidence of the mesh.
+ */
+SurfMesh surfMesh(const Rcpp::IntegerMatrix &faces, int nV) {
+  if (faces.ncol() != 3) { Rcpp::stop("`faces` must have three columns."); }
+  SurfMesh m;
+  m.nV = nV;
+  m.nF = faces.nrow();
+  m.tri.resize((std::size_t) m.nF * 3);
+  m.vp.assign(nV + 1, 0);
+  for (int f = 0; f < m.nF; f++) {
+    for (int a = 0; a < 3; a++) {
+      int v = faces(f, a) - 1;
+      if (v < 0 || v >= nV) { Rcpp::stop("`faces` is out of bounds."); }
+      m.tri[3 * f + a] = v;
+      m.vp[v + 1]++;
+    }
+  }
+  for (int v = 0; v < nV; v++) { m.vp[v + 1] += m.vp[v]; }
+  m.vf.resize(m.vp[nV]);
+  std::vector<int> fill(m.vp.begin(), m.vp.end() - 1);
+  for (int f = 0; f < m.nF; f++) {
+    for (int a = 0; a < 3; a++) { m.vf[fill[m.tri[3 * f + a]]++] = f; }
+  }
+  return m;
+}
+
+/*
+ The area of each face, and the 3 x 3 local stiffness matrix e_a . e_b / (4 A)
+ of each face (column-major, nine entries per face), where e_a is the edge
+ opposite its vertex a, as in galerkin_db(surface = TRUE). Faces are
+ independent, so they are split over the threads. Returns false if a face is
+ degenerate.
+ */
+bool faceTerms(const Eigen::Map<Eigen::MatrixXd> &vertices, const SurfMesh &m,
+               int n_threads, std::vector<double> &area, std::vector<double> &gloc) {
+  area.resize(m.nF);
+  gloc.resize((std::size_t) m.nF * 9);
+  int n_degenerate = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads(n_threads)) schedule(static) reduction(+:n_degenerate)
+#endif
+  for (int f = 0; f < m.nF; f++) {
+    Eigen::Vector3d p[3], e[3];
+    for (int a = 0; a < 3; a++) { p[a] = vertices.row(m.tri[3 * f + a]).transpose(); }
+    for (int a = 0; a < 3; a++) { e[a] = p[(a + 2) % 3] - p[(a + 1) % 3]; }
+    double A = e[1].cross(e[2]).norm() / 2.;
+    area[f] = A;
+    if (!(A > 0.)) { n_degenerate++; continue; }
+    for (int b = 0; b < 3; b++) {
+      for (int a = 0; a < 3; a++) { gloc[9 * (std::size_t) f + 3 * b + a] = e[a].dot(e[b]) / (4. * A); }
+    }
+  }
+  return n_degenerate == 0;
+}
+
+/*
+ The lumped mass of each vertex: a third of the area of each incident face.
+ */
+void lumpedMass(const SurfMesh &m, const std::vector<double> &area, int n_threads,
+                Eigen::VectorXd &c) {
+  c.resize(m.nV);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads(n_threads)) schedule(static)
+#endif
+  for (int v = 0; v < m.nV; v++) {
+    double s = 0.;
+    for (int q = m.vp[v]; q < m.vp[v + 1]; q++) { s += area[m.vf[q]]; }
+    c(v) = s / 3.;
+  }
+}
+
+typedef std::vector<std::pair<int, double> > ColumnTerms;
+
+/*
+ Assemble the n x n matrix whose column j is the sum of the terms listed by
+ colTerms(j, terms), each a (row, value) pair added to the entry (row, j).
+ Written straight into compressed-column storage in two passes over the
+ columns: the first counts the rows of each column, and the second sorts them
+ and accumulates the values. Each column belongs to a single thread, and its
+ values are summed in the order colTerms lists them, so the result does not
+ depend on the number of threads.
+ */
+template <typename ColTerms>
+Eigen::SparseMatrix<double> assembleColumns(int n, int n_threads, ColTerms colTerms) {
+  Eigen::SparseMatrix<double> M(n, n);
+  std::vector<int> count(n);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads(n_threads))
+#endif
+  {
+    std::vector<int> mark(n, -1);
+    ColumnTerms terms;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int j = 0; j < n; j++) {
+      terms.clear();
+      colTerms(j, terms);
+      int nnz = 0;
+      for (const auto &t : terms) {
+        if (mark[t.first] != j) { mark[t.first] = j; nnz++; }
+      }
+      count[j] = nnz;
+    }
+  }
+
+  int *p = M.outerIndexPtr();
+  p[0] = 0;
+  for (int j = 0; j < n; j++) { p[j + 1] = p[j] + count[j]; }
+  M.resizeNonZeros(p[n]);
+  int *ri = M.innerIndexPtr();
+  double *x = M.valuePtr();
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads(n_threads))
+#endif
+  {
+    std::vector<int> mark(n, -1);
+    std::vector<double> acc(n, 0.);
+    ColumnTerms terms;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int j = 0; j < n; j++) {
+      terms.clear();
+      colTerms(j, terms);
+      int *rows = ri + p[j];
+      int nnz = 0;
+      for (const auto &t : terms) {
+        if (mark[t.first] != j) { mark[t.first] = j; rows[nnz++] = t.first; }
+        acc[t.first] += t.second;
+      }
+      std::sort(rows, rows + nnz);
+      for (int q = 0; q < nnz; q++) {
+        x[p[j] + q] = acc[rows[q]];
+        acc[rows[q]] = 0.;
+      }
+    }
+  }
+  return M;
+}
+
+/*
+ Assemble the lumped mass C, the stiffness G and G C^{-1} G of the surface
+ mesh m. Returns false, leaving the matrices empty, if a face is degenerate.
+ */
+bool surfFEM(const Eigen::Map<Eigen::MatrixXd> &vertices, const SurfMesh &m, int n_threads,
+             Eigen::SparseMatrix<double> &C, Eigen::SparseMatrix<double> &G,
+             Eigen::SparseMatrix<double> &GtCinvG) {
+  std::vector<double> area, gloc;
+  if (!faceTerms(vertices, m, n_threads, area, gloc)) { return false; }
+  Eigen::VectorXd c;
+  lumpedMass(m, area, n_threads, c);
+  int nV = m.nV;
+
+  C.resize(nV, nV);
+  C.resizeNonZeros(nV);
+  for (int v = 0; v < nV; v++) {
+    C.outerIndexPtr()[v] = v;
+    C.innerIndexPtr()[v] = v;
+    C.valuePtr()[v] = c(v);
+  }
+  C.outerIndexPtr()[nV] = nV;
+
+  // Column j of G: the local stiffness of each face around vertex j.
+  G = assembleColumns(nV, n_threads, [&](int j, ColumnTerms &terms) {
+    for (int q = m.vp[j]; q < m.vp[j + 1]; q++) {
+      int f = m.vf[q];
+      const int *t = &m.tri[3 * (std::size_t) f];
+      int b = t[0] == j ? 0 : (t[1] == j ? 1 : 2);
+      for (int a = 0; a < 3; a++) {
+        terms.push_back(std::make_pair(t[a], gloc[9 * (std::size_t) f + 3 * b + a]));
+      }
+    }
+  });
+
+  // Column j of G C^{-1} G: the columns k of G in the pattern of column j,
+  //   weighted by G(k, j) / c(k).
+  const int *gp = G.outerIndexPtr(), *gi = G.innerIndexPtr();
+  const double *gx = G.valuePtr();
+  GtCinvG = assembleColumns(nV, n_threads, [&](int j, ColumnTerms &terms) {
+    for (int q = gp[j]; q < gp[j + 1]; q++) {
+      int k = gi[q];
+      double w = gx[q] / c(k);
+      for (int r = gp[k]; r < gp[k + 1]; r++) { terms.push_back(std::make_pair(gi[r], gx[r] * w)); }
+    }
+  });
+  return true;
+}
+
+//' Lumped mass of a triangular surface mesh
+//'
+//' The area associated with each vertex of the mesh: a third of the area of
+//'   each face it belongs to. This is the diagonal of the lumped mass matrix
+//'   \code{C} of \code{.surfFEMCpp}.
+//'
+//' @param vertices the \eqn{V \times 3} matrix of vertex coordinates
+//' @param faces the \eqn{F \times 3} matrix of (1-based) vertex indices
+//' @param n_threads the number of threads to use
+//'
+// [[Rcpp::export(.surfLumpedMassCpp, rng = false)]]
+Eigen::VectorXd surfLumpedMassCpp(const Eigen::Map<Eigen::MatrixXd> vertices,
+                                  const Rcpp::IntegerMatrix faces, int n_threads = 1) {
+  if (vertices.cols() != 3) { Rcpp::stop("`vertices` must have three columns."); }
+  SurfMesh m = surfMesh(faces, vertices.rows());
+  std::vector<double> area, gloc;
+  faceTerms(vertices, m, n_threads, area, gloc);
+  Eigen::VectorXd c;
+  lumpedMass(m, area, n_threads, c);
+  return c;
+}
+
+//' Sparse FEM matrices for a triangular surface mesh
+//'
+//' Assembles the matrices of the SPDE precision on the piecewise-linear FEM of
+//'   a triangulated surface, as used by the EM: the lumped (diagonal) mass
+//'   matrix \code{Cmat}, the stiffness matrix \code{Gmat}, and
+//'   \code{GtCinvG}, \eqn{G C^{-1} G} with the lumped \eqn{C}. These match
+//'   \code{M0}, \code{M1/2} and \code{M2} of \code{INLA::inla.spde2.matern} on
+//'   the same mesh. The face terms are computed in parallel over faces, and
+//'   each column of \code{Gmat} and \code{GtCinvG} is assembled by a single
+//'   thread from the faces around its vertex, directly in compressed form.
+//'
+//' @param vertices the \eqn{V \times 3} matrix of vertex coordinates
+//' @param faces the \eqn{F \times 3} matrix of (1-based) vertex indices
+//' @param n_threads the number of threads to use
+//'
+//' @return A list with the sparse \eqn{V \times V} matrices \code{Cmat},
+//'   \code{Gmat} and \code{GtCinvG}.
+//'
+// [[Rcpp::export(.surfFEMCpp, rng = false)]]
+Rcpp::List surfFEMCpp(const Eigen::Map<Eigen::MatrixXd> vertices,
+                      const Rcpp::IntegerMatrix faces, int n_threads = 1) {
+  if (vertices.cols() != 3) { Rcpp::stop("`vertices` must have three columns."); }
+  SurfMesh m = surfMesh(faces, vertices.rows());
+  Eigen::SparseMatrix<double> C, G, GtCinvG;
+  if (!surfFEM(vertices, m, n_threads, C, G, GtCinvG)) {
+    Rcpp::stop("`faces` includes a triangle of zero area.");
+  }
+  return Rcpp::List::create(Named("Cmat") = C,
+                            Named("Gmat") = G,
+                            Named("GtCinvG") = GtCinvG);
+}
@@ -0,0 +1,46 @@
+#ifndef BAYESFMRI_THREADS_H
+#define BAYESFMRI_THREADS_H
+
+#include <RcppEigen.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ Thread control shared by the native kernels. Every parallel region in src/ is
+ an OpenMP team sized by nThreads(n_threads), where n_threads is passed down
+ from the R entry point, so the OpenMP runtime keeps a single pool of worker
+ threads that all kernels reuse. Kernels never reduce across threads: each
+ thread writes the results for its own locations (or models), and any sum
+ over them is taken afterwards in a fixed order, so results do not depend on
+ the number of threads.
+ */
+
+/*
+ The number of threads to use for a request of n_threads: at least one, and
+ at most the number of processors. Without OpenMP, always one.
+ */
+inline int nThreads(int n_threads) {
+#ifdef _OPENMP
+  return std::max(1, std::min(n_threads, omp_get_num_procs()));
+#else
+  return 1;
+#endif
+}
+
+/*
+ Let Eigen's own parallel products use n threads while the guard is alive, and
+ restore the previous setting afterwards. Only used around products outside
+ of parallel regions; inside a region, Eigen runs single-threaded, so the
+ kernels do not oversubscribe the processors.
+ */
+class EigenThreads {
+public:
+  explicit EigenThreads(int n) : prev_(Eigen::nbThreads()) { Eigen::setNbThreads(n); }
+  ~EigenThreads() { Eigen::setNbThreads(prev_); }
+private:
+  int prev_;
+};
+
+#endif
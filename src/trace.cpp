@@ -0,0 +1,39 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "threads.h"
+
+using namespace Rcpp;
+using namespace Eigen;
+
+//' Process statistics for the stage tracer
+//'
+//' The peak resident set size of the R process so far, which includes the
+//'   memory allocated by the native kernels outside of the R heap, and the
+//'   number of threads a kernel actually uses for a request of
+//'   \code{n_threads}.
+//'
+//' @param n_threads the number of threads requested
+//'
+//' @return A list with \code{peak_rss}, the peak resident set size in Mb
+//'   (\code{NA} on Windows), and \code{n_threads}.
+//'
+// [[Rcpp::export(.traceProbeCpp, rng = false)]]
+Rcpp::List traceProbeCpp(int n_threads = 1) {
+  double peak_rss = NA_REAL;
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    peak_rss = usage.ru_maxrss / 1048576.;
+#else
+    peak_rss = usage.ru_maxrss / 1024.;
+#endif
+  }
+#endif
+  return Rcpp::List::create(Named("peak_rss") = peak_rss,
+                            Named("n_threads") = nThreads(n_threads));
+}
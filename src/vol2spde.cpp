@@ -0,0 +1,142 @@
+#define EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
+#include <Rcpp.h>
+#include <RcppEigen.h>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace Rcpp;
+using namespace Eigen;
+
+/*
+ Piecewise-linear FEM on the 1D mesh with nodes loc and free boundaries, as in
+ INLA::inla.mesh.fem(INLA::inla.mesh.1d(loc)): the lumped mass c, and the
+ stiffness matrix with diagonal gd and off-diagonal go (go[i] couples i, i+1).
+ */
+void fem1d(const Eigen::VectorXd &loc, Eigen::VectorXd &c,
+           Eigen::VectorXd &gd, Eigen::VectorXd &go) {
+  int n = loc.size();
+  c = Eigen::VectorXd::Zero(n);
+  gd = Eigen::VectorXd::Zero(n);
+  go = Eigen::VectorXd::Zero(std::max(n - 1, 0));
+  for (int i = 0; i < n - 1; i++) {
+    double h = loc(i + 1) - loc(i);
+    c(i) += h / 2.;
+    c(i + 1) += h / 2.;
+    gd(i) += 1. / h;
+    gd(i + 1) += 1. / h;
+    go(i) = -1. / h;
+  }
+}
+
+/*
+ Keep the lattice points within `radius` steps of the in-mask points idx
+ (0-based linear indices), and assemble C, G and G'C^{-1}G on them. idx2
+ receives the kept points, sorted.
+ */
+void latticeFEM(const Eigen::VectorXd &x, const Eigen::VectorXd &y, const Eigen::VectorXd &z,
+                const std::vector<long long> &idx, int radius,
+                std::vector<long long> &idx2, Eigen::SparseMatrix<double> &C,
+                Eigen::SparseMatrix<double> &G, Eigen::SparseMatrix<double> &GtCinvG) {
+  long long nx = x.size(), ny = y.size(), nz = z.size();
+  long long nxy = nx * ny;
+
+  // Lattice points within `radius` steps of the mask: multi-source BFS.
+  std::unordered_map<long long, int> pos;
+  pos.reserve(idx.size() * 2);
+  std::vector<long long> frontier, next;
+  for (long long p : idx) {
+    if (pos.emplace(p, 0).second) { frontier.push_back(p); }
+  }
+  for (int d = 1; d <= radius && !frontier.empty(); d++) {
+    next.clear();
+    for (long long p : frontier) {
+      long long i = p % nx, j = (p / nx) % ny, k = p / nxy;
+      long long nb[6] = {i > 0 ? p - 1 : -1, i < nx - 1 ? p + 1 : -1,
+                         j > 0 ? p - nx : -1, j < ny - 1 ? p + nx : -1,
+                         k > 0 ? p - nxy : -1, k < nz - 1 ? p + nxy : -1};
+      for (int q = 0; q < 6; q++) {
+        if (nb[q] >= 0 && pos.emplace(nb[q], d).second) { next.push_back(nb[q]); }
+      }
+    }
+    frontier.swap(next);
+  }
+  idx2.clear();
+  idx2.reserve(pos.size());
+  for (const auto &kv : pos) { idx2.push_back(kv.first); }
+  std::sort(idx2.begin(), idx2.end());
+  int n2 = idx2.size();
+  for (int r = 0; r < n2; r++) { pos[idx2[r]] = r; }
+
+  // Tensor-product FEM, restricted to the kept points.
+  Eigen::VectorXd cx, cy, cz, gdx, gdy, gdz, gox, goy, goz;
+  fem1d(x, cx, gdx, gox);
+  fem1d(y, cy, gdy, goy);
+  fem1d(z, cz, gdz, goz);
+  Eigen::VectorXd Cdiag(n2);
+  std::vector<Eigen::Triplet<double> > trips;
+  trips.reserve((std::size_t) n2 * 7);
+  for (int r = 0; r < n2; r++) {
+    long long p = idx2[r];
+    long long i = p % nx, j = (p / nx) % ny, k = p / nxy;
+    Cdiag(r) = cx(i) * cy(j) * cz(k);
+    trips.push_back(Eigen::Triplet<double>(r, r,
+      cz(k) * cy(j) * gdx(i) + cz(k) * gdy(j) * cx(i) + gdz(k) * cy(j) * cx(i)));
+    // Off-diagonals toward each lower neighbor, mirrored for symmetry.
+    long long nb[3] = {i > 0 ? p - 1 : -1, j > 0 ? p - nx : -1, k > 0 ? p - nxy : -1};
+    double val[3] = {i > 0 ? cz(k) * cy(j) * gox(i - 1) : 0.,
+                     j > 0 ? cz(k) * goy(j - 1) * cx(i) : 0.,
+                     k > 0 ? goz(k - 1) * cy(j) * cx(i) : 0.};
+    for (int q = 0; q < 3; q++) {
+      if (nb[q] < 0) { continue; }
+      auto it = pos.find(nb[q]);
+      if (it == pos.end()) { continue; }
+      trips.push_back(Eigen::Triplet<double>(r, it->second, val[q]));
+      trips.push_back(Eigen::Triplet<double>(it->second, r, val[q]));
+    }
+  }
+  C.resize(n2, n2);
+  G.resize(n2, n2);
+  std::vector<Eigen::Triplet<double> > ctrips;
+  ctrips.reserve(n2);
+  for (int r = 0; r < n2; r++) { ctrips.push_back(Eigen::Triplet<double>(r, r, Cdiag(r))); }
+  C.setFromTriplets(ctrips.begin(), ctrips.end());
+  G.setFromTriplets(trips.begin(), trips.end());
+  Eigen::SparseMatrix<double> CinvG = Cdiag.cwiseInverse().asDiagonal() * G;
+  GtCinvG = G * CinvG;
+}
+
+//' Sparse FEM matrices for a masked 3D lattice
+//'
+//' Assembles the mass matrix \code{C}, the stiffness matrix \code{G} and
+//'   \code{GtCinvG} of the tensor-product piecewise-linear FEM on the lattice
+//'   \code{x} by \code{y} by \code{z}, keeping only the lattice points within
+//'   \code{radius} steps of an in-mask location. The kept points are found by
+//'   a breadth-first search from the in-mask locations, and the matrices are
+//'   built from the seven-point stencil of \code{G}, so the full lattice is
+//'   never formed.
+//'
+//' @param x,y,z the coordinates of the lattice along each axis
+//' @param idx the (1-based) linear indices of the in-mask lattice points
+//' @param radius the number of neighbor steps around in-mask locations to keep
+//'
+// [[Rcpp::export(.vol2spdeCpp, rng = false)]]
+Rcpp::List vol2spdeCpp(Eigen::VectorXd x, Eigen::VectorXd y, Eigen::VectorXd z,
+                       Rcpp::IntegerVector idx, int radius) {
+  long long nbox = (long long) x.size() * y.size() * z.size();
+  std::vector<long long> idx0(idx.size());
+  for (int ii = 0; ii < idx.size(); ii++) {
+    idx0[ii] = (long long) idx[ii] - 1;
+    if (idx0[ii] < 0 || idx0[ii] >= nbox) { Rcpp::stop("`idx` is out of bounds."); }
+  }
+  std::vector<long long> idx2;
+  Eigen::SparseMatrix<double> C, G, GtCinvG;
+  latticeFEM(x, y, z, idx0, radius, idx2, C, G, GtCinvG);
+  int n2 = idx2.size();
+
+  Rcpp::IntegerVector idx2_out(n2);
+  for (int r = 0; r < n2; r++) { idx2_out[r] = (int) (idx2[r] + 1); }
+  return Rcpp::List::create(Named("C") = C,
+                            Named("G") = G,
+                            Named("GtCinvG") = GtCinvG,
+                            Named("idx2") = idx2_out);
+}